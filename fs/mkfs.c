@@ -0,0 +1,259 @@
+/*
+ * mkfs: build an image of the extent file system (inc/fs.h) from a
+ * directory tree on the host.
+ *
+ *    mkfs image nblocks [dir]
+ *
+ * Every file is written as a single extent and every directory gets enough
+ * hash buckets to keep its chains short, so the image starts out with no
+ * fragmentation at all.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* Prevent inc/types.h, included from inc/fs.h, from attempting to redefine
+ * types defined in the host's headers. */
+#define JOS_INC_TYPES_H
+typedef int bool;
+typedef uint32_t physaddr_t;
+#define ROUNDUP(a, n)   (((a) + (n) - 1) / (n) * (n))
+
+#include <inc/mmu.h>
+#include <inc/fs.h>
+
+static char *disk;
+static struct fs_super *super;
+static uint32_t nextblk;        /* next free block, allocated in order */
+static uint32_t nextino = FS_ROOT_INO;
+
+static void panic(const char *fmt, ...) __attribute__((noreturn));
+
+static void panic(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "mkfs: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+static void *blk(uint32_t b)
+{
+    return disk + (size_t) b * FS_BLKSIZE;
+}
+
+static uint32_t alloc_blocks(uint32_t n)
+{
+    uint32_t b = nextblk, i;
+    uint32_t *bitmap = blk(super->s_bitmap);
+
+    if (n > super->s_nblocks - nextblk)
+        panic("image full: need %u more blocks", n);
+    for (i = b; i < b + n; i++)
+        bitmap[i / 32] |= 1U << (i % 32);
+    nextblk += n;
+    return b;
+}
+
+static uint32_t alloc_inode(int type, struct fs_inode **ipp)
+{
+    struct fs_inode *ip;
+    uint32_t ino = nextino++;
+
+    if (ino >= super->s_ninodes)
+        panic("out of inodes");
+    ip = (struct fs_inode *) blk(super->s_inodes) + ino;
+    ip->i_type = type;
+    ip->i_nlink = 1;
+    *ipp = ip;
+    return ino;
+}
+
+/* Map the inode's blocks [0, n) with a single extent starting at 'b'. */
+static void set_extent(struct fs_inode *ip, uint32_t b, uint32_t n)
+{
+    if (n == 0)
+        return;
+    ip->i_nextent = 1;
+    ip->i_ext[0].e_lblk = 0;
+    ip->i_ext[0].e_pblk = b;
+    ip->i_ext[0].e_len = n;
+}
+
+static uint32_t add_file(const char *path, off_t size)
+{
+    struct fs_inode *ip;
+    uint32_t ino, n = ROUNDUP(size, FS_BLKSIZE) / FS_BLKSIZE, b;
+    FILE *f;
+
+    ino = alloc_inode(FS_TYPE_FILE, &ip);
+    b = alloc_blocks(n);
+    if (!(f = fopen(path, "rb")))
+        panic("%s: %s", path, strerror(errno));
+    if (fread(blk(b), 1, size, f) != (size_t) size)
+        panic("%s: short read", path);
+    fclose(f);
+    ip->i_size = size;
+    set_extent(ip, b, n);
+    return ino;
+}
+
+struct entry {
+    char name[FS_NAMELEN];
+    int namelen;
+    uint32_t ino;
+    int type;
+};
+
+/* Lay out a directory's entries as a hash table in memory and give it one
+ * extent. */
+static void write_dir(struct fs_inode *ip, struct entry *ents, int nents)
+{
+    uint32_t nbuckets = 1, nblocks, h, b, i, start;
+    struct fs_dirhdr *hdr;
+    struct fs_dirent *e;
+    char *tbl;
+
+    /* Buckets for 3/4 load, so few of them overflow. */
+    while (nbuckets * FS_DIRENTS_PER_BLOCK * 3 / 4 < (uint32_t) nents)
+        nbuckets *= 2;
+    nblocks = nbuckets;
+    tbl = calloc(nblocks, FS_BLKSIZE);
+
+    for (i = 0; i < (uint32_t) nents; i++) {
+        h = fs_name_hash(ents[i].name, ents[i].namelen);
+        for (b = h % nbuckets; ; b = hdr->h_next) {
+            hdr = (struct fs_dirhdr *) (tbl + (size_t) b * FS_BLKSIZE);
+            if (hdr->h_count < FS_DIRENTS_PER_BLOCK)
+                break;
+            if (!hdr->h_next) {
+                tbl = realloc(tbl, (size_t) (nblocks + 1) * FS_BLKSIZE);
+                memset(tbl + (size_t) nblocks * FS_BLKSIZE, 0, FS_BLKSIZE);
+                hdr = (struct fs_dirhdr *) (tbl + (size_t) b * FS_BLKSIZE);
+                hdr->h_next = nblocks++;
+            }
+        }
+        e = (struct fs_dirent *) hdr + 1;
+        while (e->d_ino)
+            e++;
+        e->d_ino = ents[i].ino;
+        e->d_hash = h;
+        e->d_namelen = ents[i].namelen;
+        e->d_type = ents[i].type;
+        memcpy(e->d_name, ents[i].name, ents[i].namelen);
+        hdr->h_count++;
+    }
+
+    start = alloc_blocks(nblocks);
+    memcpy(blk(start), tbl, (size_t) nblocks * FS_BLKSIZE);
+    free(tbl);
+    ip->i_nbuckets = nbuckets;
+    ip->i_size = (uint64_t) nblocks * FS_BLKSIZE;
+    set_extent(ip, start, nblocks);
+}
+
+static uint32_t add_dir(const char *path)
+{
+    struct entry *ents = NULL;
+    struct fs_inode *ip;
+    struct dirent *de;
+    struct stat st;
+    char sub[PATH_MAX];
+    int nents = 0, len;
+    uint32_t ino;
+    DIR *d;
+
+    ino = alloc_inode(FS_TYPE_DIR, &ip);
+    if (!path) {
+        write_dir(ip, NULL, 0);
+        return ino;
+    }
+    if (!(d = opendir(path)))
+        panic("%s: %s", path, strerror(errno));
+    while ((de = readdir(d))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if ((len = strlen(de->d_name)) > FS_NAMELEN)
+            panic("%s/%s: name too long", path, de->d_name);
+        snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+        if (stat(sub, &st) < 0)
+            panic("%s: %s", sub, strerror(errno));
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+            continue;
+
+        ents = realloc(ents, (nents + 1) * sizeof(*ents));
+        memcpy(ents[nents].name, de->d_name, len);
+        ents[nents].namelen = len;
+        if (S_ISDIR(st.st_mode)) {
+            ents[nents].type = FS_TYPE_DIR;
+            ents[nents].ino = add_dir(sub);
+        } else {
+            ents[nents].type = FS_TYPE_FILE;
+            ents[nents].ino = add_file(sub, st.st_size);
+        }
+        nents++;
+    }
+    closedir(d);
+
+    write_dir(ip, ents, nents);
+    free(ents);
+    return ino;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t nblocks, nbitmap, ninodes, i;
+    FILE *f;
+
+    if (sizeof(struct fs_inode) != FS_INODE_SIZE ||
+        sizeof(struct fs_dirhdr) != sizeof(struct fs_dirent))
+        panic("struct sizes do not match inc/fs.h");
+
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: mkfs image nblocks [dir]\n");
+        return 2;
+    }
+    nblocks = strtoul(argv[2], NULL, 0);
+    nbitmap = ROUNDUP(nblocks, FS_BLKSIZE * 8) / (FS_BLKSIZE * 8);
+    ninodes = ROUNDUP(nblocks / 8 + 2, FS_INODES_PER_BLOCK);
+    if (nblocks < 2 + nbitmap + ninodes / FS_INODES_PER_BLOCK + 1)
+        panic("%u blocks is too small", nblocks);
+    if (!(disk = calloc(nblocks, FS_BLKSIZE)))
+        panic("out of memory");
+
+    super = blk(FS_SUPER_BLOCK);
+    super->s_magic = FS_MAGIC;
+    super->s_nblocks = nblocks;
+    super->s_bitmap = FS_SUPER_BLOCK + 1;
+    super->s_inodes = super->s_bitmap + nbitmap;
+    super->s_ninodes = ninodes;
+    super->s_data = super->s_inodes + ninodes / FS_INODES_PER_BLOCK;
+
+    /* Everything up to the data area is in use, and so are the bits past
+     * the last block. */
+    alloc_blocks(super->s_data);
+    for (i = nblocks; i < nbitmap * FS_BLKSIZE * 8; i++)
+        ((uint32_t *) blk(super->s_bitmap))[i / 32] |= 1U << (i % 32);
+
+    if (add_dir(argc == 4 ? argv[3] : NULL) != FS_ROOT_INO)
+        panic("root is not inode %u", FS_ROOT_INO);
+
+    if (!(f = fopen(argv[1], "wb")))
+        panic("%s: %s", argv[1], strerror(errno));
+    if (fwrite(disk, FS_BLKSIZE, nblocks, f) != nblocks || fclose(f) != 0)
+        panic("%s: write failed", argv[1]);
+    printf("%s: %u blocks, %u used, %u inodes, %u used\n", argv[1],
+           nblocks, nextblk, ninodes, nextino);
+    return 0;
+}
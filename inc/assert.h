@@ -3,10 +3,12 @@
 #ifndef JOS_INC_ASSERT_H
 #define JOS_INC_ASSERT_H
 
+#include <inc/types.h>
 #include <inc/stdio.h>
 
-void _warn(const char*, int, const char*, ...);
-void _panic(const char*, int, const char*, ...) __attribute__((noreturn));
+__cold void _warn(const char*, int, const char*, ...);
+__cold void _panic(const char*, int, const char*, ...)
+    __attribute__((noreturn));
 
 #define warn(...) _warn(__FILE__, __LINE__, __VA_ARGS__)
 #define panic(...) _panic(__FILE__, __LINE__, __VA_ARGS__)
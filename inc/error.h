@@ -14,6 +14,11 @@ enum {
                             /* the maximum allowed */
     E_FAULT         = 6,    /* Memory fault */
     E_NO_SYS        = 7,    /* Unimplemented system call */
+    E_IO            = 8,    /* Device I/O error */
+    E_NOT_FOUND     = 9,    /* Device or file not found */
+    E_NO_DISK       = 10,   /* No free space left on disk */
+    E_BAD_PATH      = 11,   /* Bad path */
+    E_FILE_EXISTS   = 12,   /* File already exists */
 
     MAXERROR
 };
@@ -0,0 +1,103 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_INC_FS_H
+#define JOS_INC_FS_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+/*
+ * On-disk format of the extent file system, shared by the kernel (kern/fs.c)
+ * and the host tool that builds images (fs/mkfs.c).
+ *
+ *    block 0               unused (boot sector)
+ *    block 1               superblock
+ *    s_bitmap ...          free-block bitmap, one bit per block, 1 = used
+ *    s_inodes ...          inode table, FS_INODES_PER_BLOCK per block
+ *    s_data ...            file and directory blocks
+ *
+ * A file maps its blocks with extents, runs of contiguous disk blocks:
+ * FS_NDIRECT_EXT in the inode and up to FS_NINDIRECT_EXT more in one extent
+ * block.  Extents are sorted by file block; blocks no extent covers are
+ * holes and read as zeroes.
+ */
+
+#define FS_MAGIC            0x46545845  /* "EXTF" */
+#define FS_BLKSIZE          PGSIZE
+#define FS_SUPER_BLOCK      1
+
+#define FS_ROOT_INO         1           /* inode 0 is never used */
+
+struct fs_super {
+    uint32_t s_magic;
+    uint32_t s_nblocks;         /* blocks in the file system */
+    uint32_t s_bitmap;          /* first bitmap block */
+    uint32_t s_inodes;          /* first inode table block */
+    uint32_t s_ninodes;
+    uint32_t s_data;            /* first data block */
+};
+
+struct fs_extent {
+    uint32_t e_lblk;            /* first file block */
+    uint32_t e_pblk;            /* first disk block */
+    uint32_t e_len;             /* blocks */
+};
+
+#define FS_NDIRECT_EXT      8
+#define FS_NINDIRECT_EXT    (FS_BLKSIZE / sizeof(struct fs_extent))
+
+/* Inode types */
+#define FS_TYPE_FREE        0
+#define FS_TYPE_FILE        1
+#define FS_TYPE_DIR         2
+
+struct fs_inode {
+    uint16_t i_type;
+    uint16_t i_nlink;
+    uint32_t i_nextent;         /* extents in use */
+    uint64_t i_size;            /* bytes */
+    uint32_t i_extblk;          /* block of extents past FS_NDIRECT_EXT */
+    uint32_t i_nbuckets;        /* directories: hash buckets */
+    struct fs_extent i_ext[FS_NDIRECT_EXT];
+    uint8_t i_pad[8];
+};
+
+#define FS_INODE_SIZE       128
+#define FS_INODES_PER_BLOCK (FS_BLKSIZE / FS_INODE_SIZE)
+
+/*
+ * A directory is a hash table.  Its first i_nbuckets blocks are the
+ * buckets, a power of two of them; a name lives in bucket
+ * fs_name_hash(name) % i_nbuckets or in one of the overflow blocks chained
+ * behind it through h_next.  Every block starts with a header the size of
+ * a directory entry.
+ */
+#define FS_NAMELEN          54
+
+struct fs_dirent {
+    uint32_t d_ino;             /* 0 if the slot is free */
+    uint32_t d_hash;
+    uint8_t d_namelen;
+    uint8_t d_type;
+    char d_name[FS_NAMELEN];    /* not NUL-terminated */
+};
+
+struct fs_dirhdr {
+    uint32_t h_next;            /* file block of the next overflow block */
+    uint32_t h_count;           /* entries in use in this block */
+    uint8_t h_pad[56];
+};
+
+#define FS_DIRENTS_PER_BLOCK (FS_BLKSIZE / sizeof(struct fs_dirent) - 1)
+
+/* FNV-1a */
+static inline uint32_t fs_name_hash(const char *name, int len)
+{
+    uint32_t h = 2166136261U;
+
+    while (len-- > 0)
+        h = (h ^ (uint8_t) *name++) * 16777619U;
+    return h;
+}
+
+#endif /* !JOS_INC_FS_H */
@@ -45,19 +45,21 @@
  *                     :              .               :                   |
  *    MMIOLIM ------>  +------------------------------+ 0xefc00000      --+
  *                     |       Memory-mapped I/O      | RW/--  PTSIZE
- * ULIM, MMIOBASE -->  +------------------------------+ 0xef800000
+ * MMIOBASE,VMALLOCLIM +------------------------------+ 0xef800000
+ *                     |     Kernel Virtual Memory    | RW/--  VMALLOCSIZE
+ * ULIM,VMALLOCBASE -> +------------------------------+ 0xee800000
  *                     |  Cur. Page Table (User R-)   | R-/R-  PTSIZE
- *    UVPT      ---->  +------------------------------+ 0xef400000
+ *    UVPT      ---->  +------------------------------+ 0xee400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
- *    UPAGES    ---->  +------------------------------+ 0xef000000
+ *    UPAGES    ---->  +------------------------------+ 0xee000000
  *                     |           RO ENVS            | R-/R-  PTSIZE
- * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
+ * UTOP,UENVS ------>  +------------------------------+ 0xedc00000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebff000
+ *                     +------------------------------+ 0xedbff000
  *                     |       Empty Memory (*)       | --/--  PGSIZE
- *    USTACKTOP  --->  +------------------------------+ 0xeebfe000
+ *    USTACKTOP  --->  +------------------------------+ 0xedbfe000
  *                     |      Normal User Stack       | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebfd000
+ *                     +------------------------------+ 0xedbfd000
  *                     |                              |
  *                     |                              |
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -101,7 +103,13 @@
 #define MMIOLIM     (KSTACKTOP - PTSIZE)
 #define MMIOBASE    (MMIOLIM - PTSIZE)
 
-#define ULIM        (MMIOBASE)
+/* Virtually contiguous kernel memory (kern/vmalloc.c), with a page table
+ * per PTSIZE in entrypgdir.c. */
+#define VMALLOCLIM  MMIOBASE
+#define VMALLOCSIZE (4*PTSIZE)
+#define VMALLOCBASE (VMALLOCLIM - VMALLOCSIZE)
+
+#define ULIM        (VMALLOCBASE)
 
 /*
  * User read-only mappings! Anything below here til UTOP are readonly to user.
@@ -162,6 +170,32 @@ extern volatile pte_t uvpt[];     /* VA of "virtual page table" */
 extern volatile pde_t uvpd[];     /* VA of current page directory */
 #endif
 
+/* VA of the current page directory as seen through the recursive UVPT entry.
+ * Unlike uvpd this needs no symbol from entry.S, so the kernel can use it as
+ * well. */
+#define UVPD        (UVPT + (PDX(UVPT) << PGSHIFT))
+
+/* Return the page directory entry covering 'va' in the current address space,
+ * read through UVPT without a system call. */
+static inline pde_t uvpt_pde(const void *va)
+{
+    return ((volatile pde_t *) UVPD)[PDX(va)];
+}
+
+/* Return the page table entry mapping 'va' in the current address space, or 0
+ * if its page table is not present.  For a 4MB page the PDE itself is
+ * returned, so PTE_ADDR() then yields the base of the huge page. */
+static inline pte_t uvpt_pte(const void *va)
+{
+    pde_t pde = uvpt_pde(va);
+
+    if (!(pde & PTE_P))
+        return 0;
+    if (pde & PTE_PS)
+        return pde;
+    return ((volatile pte_t *) UVPT)[PGNUM(va)];
+}
+
 /*
  * Page descriptor structures, mapped at UPAGES.
  * Read/write to the kernel, read-only to user programs.
@@ -182,7 +216,13 @@ struct page_info {
      * boot_alloc do not have valid reference count fields. */
 
     uint16_t pp_ref;
+
+    /* PP_HUGE on the first page of a 4MB page from page_alloc(ALLOC_HUGE),
+     * whose 1024 pages page_free() then returns together. */
+    uint16_t pp_flags;
 };
 
+#define PP_HUGE         0x1
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
@@ -65,12 +65,17 @@
 #define PTE_A       0x020   /* Accessed */
 #define PTE_D       0x040   /* Dirty */
 #define PTE_PS      0x080   /* Page Size */
+#define PTE_PAT     0x080   /* Page Attribute Table index (4KB pages only) */
 #define PTE_G       0x100   /* Global */
 
 /* The PTE_AVAIL bits aren't used by the kernel or interpreted by the
  * hardware, so user processes are allowed to set them arbitrarily. */
 #define PTE_AVAIL   0xE00   /* Available for software use */
 
+/* Copy-on-write: the page is shared read-only and must be copied on the first
+ * write fault.  Taken from the PTE_AVAIL bits. */
+#define PTE_COW     0x800
+
 /* Flags in PTE_SYSCALL may be used in system calls.  (Others may not.) */
 #define PTE_SYSCALL (PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
@@ -90,6 +95,8 @@
 #define CR0_CD      0x40000000  /* Cache Disable */
 #define CR0_PG      0x80000000  /* Paging */
 
+#define CR4_OSXMMEXCPT 0x00000400 /* Unmasked SSE exceptions raise #XM */
+#define CR4_OSFXSR  0x00000200  /* FXSAVE/FXRSTOR and SSE enable */
 #define CR4_PCE     0x00000100  /* Performance counter enable */
 #define CR4_MCE     0x00000040  /* Machine Check Enable */
 #define CR4_PSE     0x00000010  /* Page Size Extensions */
@@ -69,6 +69,10 @@ typedef int32_t off_t;
     (typeof(a)) (ROUNDDOWN((uint32_t) (a) + __n - 1, __n));                    \
 })
 
+/* Code that runs rarely if ever, such as self-tests, panics and the monitor:
+ * the linker keeps it after all other code (see kern/kernel.ld). */
+#define __cold  __attribute__((section(".text_cold")))
+
 /* Return the offset of 'member' relative to the beginning of a struct type */
 #define offsetof(type, member)  ((size_t) (&((type*)0)->member))
 
@@ -0,0 +1,47 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_INC_ZBIN_H
+#define JOS_INC_ZBIN_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+/*
+ * Compressed binaries, as the build links KERN_BINFILES into the kernel
+ * (tools/mkzbin.c writes them, lib/zbin.c reads them).
+ *
+ * The file is cut into ZBIN_CHUNK-byte chunks, each compressed on its own
+ * so that any page can be decompressed without the others.  The header is
+ * followed by the chunks; chunk i takes bytes [z_off[i], z_off[i + 1]) of
+ * the file, and is stored as it is when compression does not shrink it.
+ *
+ * A compressed chunk is a series of sequences, each some literal bytes
+ * followed by a copy of earlier output:
+ *
+ *    token             literal count << 4 | (match length - ZBIN_MINMATCH)
+ *    [count bytes]     more literal count, if the field was 15: each byte
+ *                      adds to it, and one below 255 ends the list
+ *    literals
+ *    offset            2 bytes, little endian: how far back to copy from
+ *    [length bytes]    more match length, as for the literal count
+ *
+ * The last sequence stops after its literals.
+ */
+
+#define ZBIN_MAGIC      0x4E49425A      /* "ZBIN" */
+#define ZBIN_CHUNK      PGSIZE
+#define ZBIN_MINMATCH   4
+
+struct zbin_hdr {
+    uint32_t z_magic;
+    uint32_t z_size;            /* size once decompressed */
+    uint32_t z_off[];           /* ZBIN_NCHUNK(z_size) + 1 chunk offsets */
+};
+
+#define ZBIN_NCHUNK(size)   (ROUNDUP((size), ZBIN_CHUNK) / ZBIN_CHUNK)
+
+int zbin_check(const void *data, size_t size);
+int zbin_decode(const uint8_t *src, size_t slen, uint8_t *dst, size_t dlen);
+int zbin_chunk(const struct zbin_hdr *z, uint32_t i, void *dst);
+
+#endif /* !JOS_INC_ZBIN_H */
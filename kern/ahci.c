@@ -0,0 +1,493 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Driver for SATA disks behind an AHCI host bus adapter, such as QEMU's
+ * ich9-ahci (-device ahci or -machine q35).
+ *
+ * Every port has a command list of up to 32 slots.  Disks that support
+ * native command queueing (NCQ) get one READ/WRITE FPDMA QUEUED command per
+ * slot, so the block layer can keep up to 32 transfers in flight and the
+ * disk may finish them in any order; other disks get one DMA command at a
+ * time.  Finished commands are noticed by ahci_intr(), which the block
+ * layer's poll hook drives until the kernel takes interrupts.  pci.c calls
+ * ahci_attach() for each SATA controller.
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/ahci.h>
+#include <kern/ata.h>
+#include <kern/blk.h>
+#include <kern/pci.h>
+#include <kern/pmap.h>
+
+#define AHCI_PROGIF         0x01    /* SATA programming interface: AHCI 1.0 */
+#define AHCI_ABAR           5       /* PCI BAR of the HBA registers */
+
+#define AHCI_MAXDISKS       4
+#define AHCI_NSLOT          32      /* command slots per port, at most */
+#define AHCI_NPRD           56      /* PRD entries per command table */
+#define AHCI_PRD_MAX        (4 * 1024 * 1024)   /* bytes per PRD entry */
+#define AHCI_SPIN           1000000 /* register polls before giving up */
+
+/* Port registers */
+struct ahci_port_regs {
+    uint32_t clb;               /* Command list base */
+    uint32_t clbu;
+    uint32_t fb;                /* Received FIS base */
+    uint32_t fbu;
+    uint32_t is;                /* Interrupt status */
+    uint32_t ie;                /* Interrupt enable */
+    uint32_t cmd;               /* Command and status */
+    uint32_t rsv0;
+    uint32_t tfd;               /* Task file data */
+    uint32_t sig;               /* Device signature */
+    uint32_t ssts;              /* SATA status */
+    uint32_t sctl;              /* SATA control */
+    uint32_t serr;              /* SATA error */
+    uint32_t sact;              /* SATA active: NCQ tags outstanding */
+    uint32_t ci;                /* Command issue */
+    uint32_t sntf;
+    uint32_t fbs;
+    uint32_t rsv1[11];
+    uint32_t vendor[4];
+};
+
+#define PORT_IS_DHRS        (1<<0)  /* D2H register FIS received */
+#define PORT_IS_SDBS        (1<<3)  /* Set device bits FIS received */
+#define PORT_IS_ERR         0x78000000  /* Fatal errors: TFES|HBFS|HBDS|IFS */
+#define PORT_CMD_ST         (1<<0)  /* Start processing the command list */
+#define PORT_CMD_SUD        (1<<1)  /* Spin up device */
+#define PORT_CMD_POD        (1<<2)  /* Power on device */
+#define PORT_CMD_FRE        (1<<4)  /* FIS receive enable */
+#define PORT_CMD_FR         (1<<14) /* FIS receive running */
+#define PORT_CMD_CR         (1<<15) /* Command list running */
+#define PORT_SSTS_DET(s)    ((s) & 0xF)
+#define   PORT_DET_PRESENT  3       /*   Device present, link up */
+#define PORT_SIG_ATA        0x00000101
+
+/* Generic host control registers, followed by the ports */
+struct ahci_hba_regs {
+    uint32_t cap;               /* Capabilities */
+    uint32_t ghc;               /* Global host control */
+    uint32_t is;                /* Interrupt status, one bit per port */
+    uint32_t pi;                /* Ports implemented */
+    uint32_t vs;                /* Version */
+    uint32_t rsv[59];
+    struct ahci_port_regs ports[32];
+};
+
+#define HBA_CAP_NCS(cap)    ((((cap) >> 8) & 0x1F) + 1) /* command slots */
+#define HBA_CAP_SNCQ        (1<<30) /* Supports NCQ */
+#define HBA_GHC_IE          (1<<1)  /* Interrupt enable */
+#define HBA_GHC_AE          (1U<<31) /* AHCI enable */
+
+/* Command header: one per slot in the command list */
+struct ahci_cmd_hdr {
+    uint16_t flags;
+    uint16_t prdtl;             /* PRD table length */
+    uint32_t prdbc;             /* PRD byte count transferred */
+    uint32_t ctba;              /* Command table base */
+    uint32_t ctbau;
+    uint32_t rsv[4];
+};
+
+#define CMD_HDR_CFL(n)      (n)     /* Command FIS length in dwords */
+#define CMD_HDR_WRITE       (1<<6)  /* Data goes to the device */
+
+/* Physical region descriptor */
+struct ahci_prd {
+    uint32_t dba;               /* Data base address */
+    uint32_t dbau;
+    uint32_t rsv;
+    uint32_t dbc;               /* Byte count - 1 */
+};
+
+/* Command table: the command FIS and the data's scatter/gather list */
+struct ahci_cmd_tbl {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t rsv[48];
+    struct ahci_prd prdt[AHCI_NPRD];
+};
+
+#define AHCI_TBL_PER_PAGE   (PGSIZE / sizeof(struct ahci_cmd_tbl))
+
+/* Register host to device FIS */
+struct fis_reg_h2d {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t command;
+    uint8_t featurel;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t featureh;
+    uint8_t countl;
+    uint8_t counth;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t rsv[4];
+};
+
+#define FIS_TYPE_REG_H2D    0x27
+#define FIS_H2D_CMD         0x80    /* The FIS updates the command register */
+
+/* The received FIS area follows the 1KB command list in the same page. */
+#define AHCI_RFIS_OFF       1024
+
+struct ahci_disk {
+    struct blk_dev dev;
+    volatile struct ahci_hba_regs *hba;
+    volatile struct ahci_port_regs *regs;
+    int port;
+    bool ncq;
+    uint32_t nslots;
+    uint32_t busy;              /* slots holding a command */
+    struct ahci_cmd_hdr *cl;    /* command list */
+    struct ahci_cmd_tbl *tbl[AHCI_NSLOT];
+    struct blk_req *slot_req[AHCI_NSLOT];   /* transfer in each slot */
+    void *scratch;              /* page for IDENTIFY and the error log */
+};
+
+static struct ahci_disk ahci_disks[AHCI_MAXDISKS];
+static int ahci_ndisks;
+
+/* Wait until the bits 'mask' of *reg read as 'val'.  Returns false if they
+ * do not within AHCI_SPIN polls. */
+static bool ahci_spin(volatile uint32_t *reg, uint32_t mask, uint32_t val)
+{
+    int spin;
+
+    for (spin = AHCI_SPIN; (*reg & mask) != val; spin--)
+        if (spin == 0)
+            return false;
+    return true;
+}
+
+static bool ahci_port_stop(volatile struct ahci_port_regs *regs)
+{
+    regs->cmd &= ~PORT_CMD_ST;
+    if (!ahci_spin(&regs->cmd, PORT_CMD_CR, 0))
+        return false;
+    regs->cmd &= ~PORT_CMD_FRE;
+    return ahci_spin(&regs->cmd, PORT_CMD_FR, 0);
+}
+
+static bool ahci_port_start(volatile struct ahci_port_regs *regs)
+{
+    regs->cmd |= PORT_CMD_FRE | PORT_CMD_SUD | PORT_CMD_POD;
+    regs->serr = ~0;
+    regs->is = ~0;
+    if (!ahci_spin(&regs->tfd, ATA_STAT_BSY | ATA_STAT_DRQ, 0))
+        return false;
+    regs->cmd |= PORT_CMD_ST;
+    return true;
+}
+
+/* Fill in the command FIS and header of 'slot'.  The caller fills in the
+ * PRD table and its length. */
+static void ahci_prep(struct ahci_disk *disk, uint32_t slot, uint8_t cmd,
+        uint64_t lba, uint16_t feature, uint16_t count, bool write)
+{
+    struct fis_reg_h2d *fis = (struct fis_reg_h2d *) disk->tbl[slot]->cfis;
+    struct ahci_cmd_hdr *hdr = &disk->cl[slot];
+
+    memset(fis, 0, sizeof(*fis));
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = FIS_H2D_CMD;
+    fis->command = cmd;
+    fis->featurel = feature;
+    fis->featureh = feature >> 8;
+    fis->lba0 = lba;
+    fis->lba1 = lba >> 8;
+    fis->lba2 = lba >> 16;
+    fis->lba3 = lba >> 24;
+    fis->lba4 = lba >> 32;
+    fis->lba5 = lba >> 40;
+    fis->device = ATA_DEV_LBA;  /* ignored by commands without an LBA */
+    fis->countl = count;
+    fis->counth = count >> 8;
+
+    hdr->flags = CMD_HDR_CFL(sizeof(*fis) / 4) | (write ? CMD_HDR_WRITE : 0);
+    hdr->prdbc = 0;
+}
+
+/* Issue the prepared command in 'slot'.  The command table must reach
+ * memory before the HBA is told to fetch it. */
+static void ahci_issue(struct ahci_disk *disk, uint32_t slot, bool queued)
+{
+    __asm __volatile("" : : : "memory");
+    disk->busy |= 1 << slot;
+    if (queued)
+        disk->regs->sact = 1 << slot;
+    disk->regs->ci = 1 << slot;
+}
+
+/* Run a non-queued command that reads 'count' sectors into the scratch page
+ * and wait for it.  The port must be idle. */
+static int ahci_exec(struct ahci_disk *disk, uint8_t cmd, uint64_t lba,
+        uint16_t count)
+{
+    volatile struct ahci_port_regs *regs = disk->regs;
+    struct ahci_cmd_tbl *tbl = disk->tbl[0];
+    int spin;
+
+    assert(!disk->busy && count * SECTSIZE <= PGSIZE);
+
+    ahci_prep(disk, 0, cmd, lba, 0, count, false);
+    tbl->prdt[0].dba = PADDR(disk->scratch);
+    tbl->prdt[0].dbau = 0;
+    tbl->prdt[0].dbc = count * SECTSIZE - 1;
+    disk->cl[0].prdtl = 1;
+    ahci_issue(disk, 0, false);
+
+    for (spin = AHCI_SPIN; regs->ci & 1; spin--)
+        if ((regs->is & PORT_IS_ERR) || spin == 0)
+            break;
+    disk->busy = 0;
+    if (regs->ci & 1) {
+        ahci_port_stop(regs);
+        ahci_port_start(regs);
+        return -E_IO;
+    }
+    regs->is = regs->is;
+    return 0;
+}
+
+static int ahci_start(struct blk_dev *dev, struct blk_req *req)
+{
+    struct ahci_disk *disk = dev->priv;
+    struct ahci_cmd_tbl *tbl;
+    struct blk_req *r;
+    uint32_t slot, nsect = 0;
+    int n = 0;
+
+    for (slot = 0; disk->busy & (1 << slot); slot++)
+        /* do nothing */;
+    assert(slot < disk->nslots);
+
+    /* One PRD entry per request: their buffers are in the kernel's direct
+     * map, so each is physically contiguous. */
+    tbl = disk->tbl[slot];
+    for (r = req; r; r = r->rq_next, n++) {
+        assert(n < AHCI_NPRD);
+        tbl->prdt[n].dba = PADDR(r->rq_buf);
+        tbl->prdt[n].dbau = 0;
+        tbl->prdt[n].dbc = r->rq_nsect * SECTSIZE - 1;
+        nsect += r->rq_nsect;
+    }
+
+    /* NCQ puts the sector count in the features register and the tag in
+     * the count register. */
+    if (disk->ncq)
+        ahci_prep(disk, slot,
+                  req->rq_write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA,
+                  req->rq_sector, nsect, slot << 3, req->rq_write);
+    else
+        ahci_prep(disk, slot,
+                  req->rq_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT,
+                  req->rq_sector, 0, nsect, req->rq_write);
+    disk->cl[slot].prdtl = n;
+    disk->slot_req[slot] = req;
+    ahci_issue(disk, slot, disk->ncq);
+    return 0;
+}
+
+/* Free 'slot' and return the transfer it held. */
+static struct blk_req *ahci_release(struct ahci_disk *disk, uint32_t slot)
+{
+    struct blk_req *req = disk->slot_req[slot];
+
+    disk->busy &= ~(1 << slot);
+    disk->slot_req[slot] = NULL;
+    return req;
+}
+
+/* A command failed.  The HBA stopped processing the command list, and after
+ * an NCQ error the disk has aborted everything outstanding and refuses
+ * queued commands until its error log is read.  Restart the port and fail
+ * every command that had not completed. */
+static void ahci_error(struct ahci_disk *disk, uint32_t is)
+{
+    volatile struct ahci_port_regs *regs = disk->regs;
+    struct blk_req *failed[AHCI_NSLOT];
+    uint32_t slot;
+    int n = 0;
+
+    warn("%s: error, is %08x tfd %08x serr %08x", disk->dev.name, is,
+         regs->tfd, regs->serr);
+
+    /* Empty the slots first: completing a transfer starts the next one. */
+    for (slot = 0; disk->busy; slot++)
+        if (disk->busy & (1 << slot))
+            failed[n++] = ahci_release(disk, slot);
+
+    if (!ahci_port_stop(regs) || !ahci_port_start(regs))
+        warn("%s: port restart failed", disk->dev.name);
+    else if (disk->ncq && ahci_exec(disk, ATA_CMD_READ_LOG_EXT,
+                                    ATA_LOG_NCQ_ERR, 1) < 0)
+        warn("%s: cannot read the NCQ error log", disk->dev.name);
+
+    while (n > 0)
+        blk_complete(&disk->dev, failed[--n], -E_IO);
+}
+
+static void ahci_port_intr(struct ahci_disk *disk)
+{
+    volatile struct ahci_port_regs *regs = disk->regs;
+    uint32_t is, done, slot;
+
+    if (!disk->busy)
+        return;
+
+    is = regs->is;
+    regs->is = is;
+    disk->hba->is = 1 << disk->port;
+
+    /* A queued command is done when the disk clears its tag in SACT;
+     * a non-queued one when the HBA clears its bit in CI. */
+    done = disk->busy & ~(regs->sact | regs->ci);
+    for (slot = 0; done; slot++)
+        if (done & (1 << slot)) {
+            done &= ~(1 << slot);
+            blk_complete(&disk->dev, ahci_release(disk, slot), 0);
+        }
+
+    if (is & PORT_IS_ERR)
+        ahci_error(disk, is);
+}
+
+void ahci_intr(void)
+{
+    int i;
+
+    for (i = 0; i < ahci_ndisks; i++)
+        ahci_port_intr(&ahci_disks[i]);
+}
+
+static void ahci_poll(struct blk_dev *dev)
+{
+    ahci_port_intr(dev->priv);
+}
+
+static const struct blk_ops ahci_ops = {
+    .start = ahci_start,
+    .poll = ahci_poll,
+};
+
+/* Give the port its command list, received FIS area and command tables,
+ * start it and identify the disk.  The pages of a port that fails to come
+ * up are not reclaimed. */
+static int ahci_probe(struct ahci_disk *disk, uint32_t cap)
+{
+    volatile struct ahci_port_regs *regs = disk->regs;
+    struct page_info *pp = NULL;
+    uint16_t *id;
+    uint32_t i, n;
+    int r;
+
+    if (!ahci_port_stop(regs))
+        return -E_IO;
+
+    disk->nslots = HBA_CAP_NCS(cap);
+    if (!(pp = page_alloc(ALLOC_ZERO)))
+        return -E_NO_MEM;
+    disk->cl = page2kva(pp);
+    regs->clb = page2pa(pp);
+    regs->clbu = 0;
+    regs->fb = page2pa(pp) + AHCI_RFIS_OFF;
+    regs->fbu = 0;
+
+    for (i = 0; i < disk->nslots; i++) {
+        n = i % AHCI_TBL_PER_PAGE;
+        if (n == 0 && !(pp = page_alloc(ALLOC_ZERO)))
+            return -E_NO_MEM;
+        disk->tbl[i] = (struct ahci_cmd_tbl *) page2kva(pp) + n;
+        disk->cl[i].ctba = page2pa(pp) + n * sizeof(struct ahci_cmd_tbl);
+        disk->cl[i].ctbau = 0;
+    }
+
+    if (!(pp = page_alloc(0)))
+        return -E_NO_MEM;
+    disk->scratch = page2kva(pp);
+
+    if (!ahci_port_start(regs))
+        return -E_IO;
+    regs->ie = PORT_IS_DHRS | PORT_IS_SDBS | PORT_IS_ERR;
+
+    if ((r = ahci_exec(disk, ATA_CMD_IDENTIFY, 0, 1)) < 0)
+        return r;
+    id = disk->scratch;
+    disk->dev.nsectors = ata_id_nsectors(id);
+    disk->ncq = (cap & HBA_CAP_SNCQ) && (id[ATA_ID_SATA_CAP] & ATA_ID_NCQ);
+    disk->dev.depth = disk->ncq ?
+        MIN(disk->nslots, (uint32_t) (id[ATA_ID_QDEPTH] & 0x1F) + 1) : 1;
+    return disk->dev.nsectors > 0 ? 0 : -E_IO;
+}
+
+/* PCI attach function for SATA controllers. */
+int ahci_attach(struct pci_func *f)
+{
+    static const char *names[] = { "ahci0", "ahci1", "ahci2", "ahci3" };
+    volatile struct ahci_hba_regs *hba;
+    volatile struct ahci_port_regs *regs;
+    struct ahci_disk *disk;
+    uint32_t cap, pi;
+    int port, r;
+
+    static_assert(sizeof(struct ahci_cmd_tbl) % 128 == 0);
+    static_assert(sizeof(struct ahci_cmd_hdr) == 32);
+
+    if (PCI_PROGIF(f->dev_class) != AHCI_PROGIF)
+        return 0;
+    if (f->reg_size[AHCI_ABAR] < sizeof(struct ahci_hba_regs) ||
+        !(hba = pci_map_bar(f, AHCI_ABAR, false)))
+        return -E_INVAL;
+    pci_func_enable(f);
+    hba->ghc |= HBA_GHC_AE;
+    cap = hba->cap;
+    pi = hba->pi;
+
+    for (port = 0; port < 32; port++) {
+        regs = &hba->ports[port];
+        if (!(pi & (1U << port)) ||
+            PORT_SSTS_DET(regs->ssts) != PORT_DET_PRESENT ||
+            regs->sig != PORT_SIG_ATA)
+            continue;
+        if (ahci_ndisks == AHCI_MAXDISKS) {
+            warn("ahci: too many disks, ignoring port %d", port);
+            break;
+        }
+
+        disk = &ahci_disks[ahci_ndisks];
+        disk->hba = hba;
+        disk->regs = regs;
+        disk->port = port;
+        if ((r = ahci_probe(disk, cap)) < 0) {
+            warn("ahci: port %d: %e", port, r);
+            continue;
+        }
+
+        disk->dev.name = names[ahci_ndisks++];
+        disk->dev.max_nsect = AHCI_PRD_MAX / SECTSIZE;
+        disk->dev.max_segs = AHCI_NPRD;
+        disk->dev.ops = &ahci_ops;
+        disk->dev.priv = disk;
+        blk_register(&disk->dev);
+        cprintf("%s: port %d, %s, queue depth %d\n", disk->dev.name, port,
+                disk->ncq ? "NCQ" : "no NCQ", disk->dev.depth);
+    }
+
+    /* Completions are polled for now, but ask for interrupts so that
+     * ahci_intr() works once they arrive. */
+    hba->ghc |= HBA_GHC_IE;
+    return 1;
+}
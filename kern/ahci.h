@@ -0,0 +1,14 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_AHCI_H
+#define JOS_KERN_AHCI_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <kern/pci.h>
+
+int ahci_attach(struct pci_func *f);
+void ahci_intr(void);
+
+#endif /* !JOS_KERN_AHCI_H */
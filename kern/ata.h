@@ -0,0 +1,58 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_ATA_H
+#define JOS_KERN_ATA_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/*
+ * Definitions shared by the drivers that speak the ATA command set, whether
+ * through the legacy task file registers (ide.c) or in FISes (ahci.c).
+ */
+
+/* Status register bits */
+#define ATA_STAT_BSY        0x80    /* Busy */
+#define ATA_STAT_DRQ        0x08    /* Data request */
+#define ATA_STAT_ERR        0x01    /* Error */
+
+/* Device register: LBA addressing */
+#define ATA_DEV_LBA         0x40
+
+/* Commands */
+#define ATA_CMD_READ        0x20
+#define ATA_CMD_READ_EXT    0x24
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_READ_LOG_EXT 0x2F
+#define ATA_CMD_WRITE       0x30
+#define ATA_CMD_WRITE_EXT   0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_FPDMA  0x60    /* READ FPDMA QUEUED (NCQ) */
+#define ATA_CMD_WRITE_FPDMA 0x61    /* WRITE FPDMA QUEUED (NCQ) */
+#define ATA_CMD_IDENTIFY    0xEC
+
+#define ATA_LOG_NCQ_ERR     0x10    /* READ LOG EXT page: NCQ command error */
+
+/* IDENTIFY DEVICE data, in 16-bit words */
+#define ATA_ID_LBA28        60      /* words 60-61: LBA28 sectors */
+#define ATA_ID_QDEPTH       75      /* bits 0-4: queue depth - 1 */
+#define ATA_ID_SATA_CAP     76      /* SATA capabilities */
+#define   ATA_ID_NCQ        (1<<8)
+#define ATA_ID_FEATURES     83      /* command sets */
+#define   ATA_ID_LBA48      (1<<10)
+#define ATA_ID_LBA48_SECT   100     /* words 100-103: LBA48 sectors */
+
+/* Return the capacity in sectors described by IDENTIFY data 'id'. */
+static inline uint64_t ata_id_nsectors(const uint16_t *id)
+{
+    if (id[ATA_ID_FEATURES] & ATA_ID_LBA48)
+        return (uint64_t) id[ATA_ID_LBA48_SECT] |
+            (uint64_t) id[ATA_ID_LBA48_SECT + 1] << 16 |
+            (uint64_t) id[ATA_ID_LBA48_SECT + 2] << 32 |
+            (uint64_t) id[ATA_ID_LBA48_SECT + 3] << 48;
+    return id[ATA_ID_LBA28] | (uint32_t) id[ATA_ID_LBA28 + 1] << 16;
+}
+
+#endif /* !JOS_KERN_ATA_H */
@@ -0,0 +1,617 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Block buffer cache with adaptive replacement (ARC, Megiddo & Modha).
+ *
+ * Resident buffers live on two LRU lists: T1 holds blocks seen once
+ * recently, T2 blocks seen at least twice.  Two ghost lists, B1 and B2,
+ * remember the blocks most recently evicted from T1 and T2 without their
+ * data.  A miss that hits a ghost list moves the target size 'p' of T1
+ * towards the list that would have kept the block, so a long sequential scan
+ * only cycles through T1 and leaves the hot blocks in T2 alone.
+ *
+ * bread() also watches for sequential access, per stream, and reads ahead of
+ * it asynchronously.  The read-ahead window starts at RA_MIN blocks and
+ * doubles each time the reader catches up with half of it, up to RA_MAX.
+ * Read-ahead blocks enter T1 and stay there on their first real access, so
+ * streaming data never pushes hot blocks out of T2.
+ *
+ * Writes are write-back: bwrite() only marks the buffer dirty.  Dirty
+ * buffers go to disk when they are evicted, on bflush(), and once too many
+ * of them have piled up or the oldest has been dirty for BCACHE_FLUSH_SEC.
+ *
+ * A device whose contents are in memory (a ramdisk) is not cached at all.
+ * Its buffers map the block in place, so reads and writes cost no copy and
+ * take no cache page.
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/bcache.h>
+#include <kern/pmap.h>
+#include <kern/tsc.h>
+
+#define BCACHE_NHDR         (2 * BCACHE_NBUF)   /* resident + ghost headers */
+#define BCACHE_NHASH        509
+#define BCACHE_DIRTY_MAX    (BCACHE_NBUF / 4)   /* flush beyond this many */
+#define BCACHE_FLUSH_SEC    5                   /* or after this long */
+
+#define RA_NSTREAM          8       /* sequential streams tracked */
+#define RA_MIN              4       /* initial read-ahead window, in blocks */
+#define RA_MAX              32      /* largest read-ahead window */
+
+enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2, ARC_FREE, ARC_MAPPED, ARC_NLIST };
+
+static struct buf bc_hdrs[BCACHE_NHDR];
+static struct buf *bc_hash[BCACHE_NHASH];
+
+/* List heads are sentinel buffers; bc_len counts their members. */
+static struct buf bc_lists[ARC_NLIST];
+static uint32_t bc_len[ARC_NLIST];
+
+static uint32_t bc_p;           /* target size of T1 */
+static uint32_t bc_nres;        /* buffers holding a page */
+static uint32_t bc_ndirty;
+static uint64_t bc_dirty_since; /* TSC when the oldest dirty buffer was made */
+
+static struct bcache_stats bc_stats;
+
+/* A reader moving sequentially through a device. */
+static struct ra_stream {
+    struct blk_dev *dev;
+    uint32_t next;              /* block a sequential reader asks for next */
+    uint32_t ra_end;            /* first block not read ahead yet */
+    uint32_t window;            /* blocks to stay ahead; 0 if not sequential */
+    uint64_t last_use;          /* stamp for LRU replacement */
+} ra_streams[RA_NSTREAM];
+static uint64_t ra_clock;
+
+
+/***************************************************************
+ * List and hash helpers.
+ ***************************************************************/
+
+static void list_remove(struct buf *b)
+{
+    b->b_prev->b_next = b->b_next;
+    b->b_next->b_prev = b->b_prev;
+    bc_len[b->b_list]--;
+}
+
+/* Insert 'b' at the MRU end of list 'l'. */
+static void list_push(int l, struct buf *b)
+{
+    struct buf *head = &bc_lists[l];
+
+    b->b_list = l;
+    b->b_next = head->b_next;
+    b->b_prev = head;
+    head->b_next->b_prev = b;
+    head->b_next = b;
+    bc_len[l]++;
+}
+
+static void list_move(int l, struct buf *b)
+{
+    list_remove(b);
+    list_push(l, b);
+}
+
+static struct buf *list_lru(int l)
+{
+    struct buf *b = bc_lists[l].b_prev;
+
+    return b == &bc_lists[l] ? NULL : b;
+}
+
+static uint32_t hash_slot(struct blk_dev *dev, uint32_t blockno)
+{
+    return ((uintptr_t) dev ^ (blockno * 2654435761U)) % BCACHE_NHASH;
+}
+
+static struct buf *hash_find(struct blk_dev *dev, uint32_t blockno)
+{
+    struct buf *b;
+
+    for (b = bc_hash[hash_slot(dev, blockno)]; b; b = b->b_hnext)
+        if (b->b_dev == dev && b->b_blockno == blockno)
+            return b;
+    return NULL;
+}
+
+static void hash_insert(struct buf *b)
+{
+    uint32_t slot = hash_slot(b->b_dev, b->b_blockno);
+
+    b->b_hnext = bc_hash[slot];
+    bc_hash[slot] = b;
+}
+
+static void hash_remove(struct buf *b)
+{
+    struct buf **pp;
+
+    for (pp = &bc_hash[hash_slot(b->b_dev, b->b_blockno)]; *pp;
+         pp = &(*pp)->b_hnext)
+        if (*pp == b) {
+            *pp = b->b_hnext;
+            return;
+        }
+    panic("bcache: buffer %u not hashed", b->b_blockno);
+}
+
+
+/***************************************************************
+ * I/O.
+ ***************************************************************/
+
+static void buf_io_done(struct blk_req *req)
+{
+    struct buf *b = req->rq_priv;
+
+    b->b_flags &= ~B_BUSY;
+    if (req->rq_status < 0) {
+        /* A failed write stays dirty so it is retried. */
+        if (req->rq_write && !(b->b_flags & B_DIRTY)) {
+            b->b_flags |= B_DIRTY;
+            bc_ndirty++;
+        }
+        return;
+    }
+    if (!req->rq_write)
+        b->b_flags |= B_VALID;
+}
+
+/* Start reading or writing the block in 'b'. */
+static void buf_start_io(struct buf *b, bool write)
+{
+    struct blk_req *req = &b->b_req;
+
+    memset(req, 0, sizeof(*req));
+    req->rq_sector = (uint64_t) b->b_blockno * BLKSECTS;
+    req->rq_nsect = BLKSECTS;
+    req->rq_write = write;
+    req->rq_buf = b->b_data;
+    req->rq_end = buf_io_done;
+    req->rq_priv = b;
+
+    if (write) {
+        b->b_flags &= ~B_DIRTY;
+        bc_ndirty--;
+        bc_stats.writebacks++;
+    }
+    b->b_flags |= B_BUSY;
+    blk_submit(b->b_dev, req);
+}
+
+static int buf_wait(struct buf *b)
+{
+    while (b->b_flags & B_BUSY)
+        blk_poll(b->b_dev);
+    return b->b_req.rq_status;
+}
+
+
+/***************************************************************
+ * Adaptive replacement.
+ ***************************************************************/
+
+/* The least recently used buffer on 'l' that nobody holds and that has no
+ * I/O in flight. */
+static struct buf *arc_victim(int l)
+{
+    struct buf *b;
+
+    for (b = bc_lists[l].b_prev; b != &bc_lists[l]; b = b->b_prev)
+        if (b->b_refcnt == 0 && !(b->b_flags & B_BUSY))
+            return b;
+    return NULL;
+}
+
+/* Forget a ghost (or page-less) buffer entirely. */
+static void arc_discard(struct buf *b)
+{
+    assert(!b->b_page);
+    hash_remove(b);
+    list_move(ARC_FREE, b);
+}
+
+/* Take the page away from resident buffer 'b', writing it back first if it
+ * is dirty, and turn 'b' into a ghost on list 'ghost'. */
+static struct page_info *arc_evict(struct buf *b, int ghost)
+{
+    struct page_info *pp;
+
+    if (b->b_flags & B_DIRTY) {
+        buf_start_io(b, true);
+        if (buf_wait(b) < 0) {
+            warn("bcache: lost write of block %u", b->b_blockno);
+            bc_ndirty--;
+        }
+    }
+
+    if (b->b_flags & B_READAHEAD)
+        bc_stats.ra_wasted++;
+
+    pp = b->b_page;
+    b->b_page = NULL;
+    b->b_data = NULL;
+    b->b_flags = 0;
+    bc_nres--;
+    bc_stats.evictions++;
+    list_move(ghost, b);
+    return pp;
+}
+
+/* ARC's REPLACE: free a page from T1 or T2, steered by 'p'.  'in_b2' says the
+ * block being brought in is a B2 ghost. */
+static struct page_info *arc_replace(bool in_b2)
+{
+    struct buf *b;
+    bool from_t1;
+
+    from_t1 = bc_len[ARC_T1] > 0 &&
+        (bc_len[ARC_T1] > bc_p || (in_b2 && bc_len[ARC_T1] == bc_p));
+
+    /* Fall back on the other list when every buffer on the preferred one is
+     * held or busy. */
+    if (from_t1) {
+        if ((b = arc_victim(ARC_T1)))
+            return arc_evict(b, ARC_B1);
+        if ((b = arc_victim(ARC_T2)))
+            return arc_evict(b, ARC_B2);
+    } else {
+        if ((b = arc_victim(ARC_T2)))
+            return arc_evict(b, ARC_B2);
+        if ((b = arc_victim(ARC_T1)))
+            return arc_evict(b, ARC_B1);
+    }
+    return NULL;
+}
+
+/* Get a page for a buffer that is about to become resident. */
+static struct page_info *arc_page(bool in_b2)
+{
+    struct page_info *pp;
+
+    if (bc_nres < BCACHE_NBUF && (pp = page_alloc(0)))
+        return pp;
+    return arc_replace(in_b2);
+}
+
+/* A header for a block the cache has no record of. */
+static struct buf *arc_header(void)
+{
+    struct buf *b;
+
+    if (!(b = list_lru(ARC_FREE)))
+        if (!(b = list_lru(ARC_B2)) && !(b = list_lru(ARC_B1)))
+            return NULL;
+    if (b->b_list != ARC_FREE)
+        arc_discard(b);
+    return b;
+}
+
+/* Find or make the resident buffer for 'blockno', adjusting the ARC lists as
+ * for an access.  The buffer's contents may not be valid yet.
+ *
+ * A read-ahead is not an access: it leaves resident buffers where they are
+ * and does not let ghost hits steer 'p'. */
+static int arc_access(struct blk_dev *dev, uint32_t blockno, bool readahead,
+        struct buf **bufp)
+{
+    struct page_info *pp;
+    struct buf *b, *lru;
+    uint32_t total;
+
+    b = hash_find(dev, blockno);
+
+    /* Case I: resident.  A second access promotes it to T2, but the first
+     * real access of a read-ahead block counts as its first. */
+    if (b && (b->b_list == ARC_T1 || b->b_list == ARC_T2)) {
+        if (!readahead) {
+            bc_stats.hits++;
+            if (b->b_flags & B_READAHEAD) {
+                b->b_flags &= ~B_READAHEAD;
+                bc_stats.ra_used++;
+                list_move(ARC_T1, b);
+            } else {
+                list_move(ARC_T2, b);
+            }
+        }
+        *bufp = b;
+        return 0;
+    }
+
+    if (readahead) {
+        bc_stats.ra_issued++;
+        if (b) {
+            if (!(pp = arc_page(false)))
+                return -E_NO_MEM;
+            list_move(ARC_T1, b);
+            if (bc_len[ARC_T1] + bc_len[ARC_B1] > BCACHE_NBUF &&
+                (lru = list_lru(ARC_B1)))
+                arc_discard(lru);
+            goto resident;
+        }
+    } else {
+        bc_stats.misses++;
+    }
+    if (b) {
+        /* Cases II and III: a ghost hit says the list it fell off was too
+         * short, so shift 'p' towards it. */
+        if (b->b_list == ARC_B1) {
+            bc_stats.ghost_hits[0]++;
+            bc_p = MIN(bc_p + MAX(bc_len[ARC_B2] / bc_len[ARC_B1], 1U),
+                       (uint32_t) BCACHE_NBUF);
+        } else {
+            bc_stats.ghost_hits[1]++;
+            bc_p -= MIN(bc_p, MAX(bc_len[ARC_B1] / bc_len[ARC_B2], 1U));
+        }
+        if (!(pp = arc_page(b->b_list == ARC_B2)))
+            return -E_NO_MEM;
+        list_move(ARC_T2, b);
+    } else {
+        /* Case IV: a complete miss. */
+        if (!(pp = arc_page(false)))
+            return -E_NO_MEM;
+
+        /* Keep the directory within its bounds: c entries for L1 = T1 + B1
+         * and 2c overall, counting the block about to join T1. */
+        total = bc_len[ARC_T1] + bc_len[ARC_T2] + bc_len[ARC_B1] +
+            bc_len[ARC_B2];
+        if (bc_len[ARC_T1] + bc_len[ARC_B1] >= BCACHE_NBUF) {
+            if ((lru = list_lru(ARC_B1)))
+                arc_discard(lru);
+        } else if (total >= 2 * BCACHE_NBUF && (lru = list_lru(ARC_B2))) {
+            arc_discard(lru);
+        }
+
+        if (!(b = arc_header())) {
+            page_free(pp);
+            return -E_NO_MEM;
+        }
+        b->b_dev = dev;
+        b->b_blockno = blockno;
+        hash_insert(b);
+        list_move(ARC_T1, b);
+    }
+
+resident:
+    b->b_page = pp;
+    b->b_data = page2kva(pp);
+    b->b_flags = readahead ? B_READAHEAD : 0;
+    b->b_refcnt = 0;
+    bc_nres++;
+    *bufp = b;
+    return 0;
+}
+
+
+/***************************************************************
+ * Interface.
+ ***************************************************************/
+
+void bcache_init(void)
+{
+    int i;
+
+    for (i = 0; i < ARC_NLIST; i++) {
+        bc_lists[i].b_next = bc_lists[i].b_prev = &bc_lists[i];
+        bc_lists[i].b_list = i;
+    }
+    for (i = 0; i < BCACHE_NHDR; i++)
+        list_push(ARC_FREE, &bc_hdrs[i]);
+}
+
+/* Start an asynchronous read of every block in [start, end) that is not
+ * already cached. */
+static void ra_issue(struct blk_dev *dev, uint32_t start, uint32_t end)
+{
+    struct buf *b;
+
+    end = MIN((uint64_t) end, dev->nsectors / BLKSECTS);
+    for (; start < end; start++) {
+        if (arc_access(dev, start, true, &b) < 0)
+            return;
+        if (!(b->b_flags & (B_VALID | B_BUSY)))
+            buf_start_io(b, false);
+    }
+}
+
+/* Feed an access to the stream detector and read ahead if it continues a
+ * sequential stream. */
+static void ra_update(struct blk_dev *dev, uint32_t blockno)
+{
+    struct ra_stream *s, *lru = &ra_streams[0];
+    int i;
+
+    /* A stream continues if the reader asks for the next block, or skips to
+     * one already read ahead. */
+    for (i = 0; i < RA_NSTREAM; i++) {
+        s = &ra_streams[i];
+        if (s->dev == dev && blockno >= s->next &&
+            (blockno == s->next || blockno < s->ra_end))
+            break;
+        if (s->last_use < lru->last_use)
+            lru = s;
+    }
+
+    if (i == RA_NSTREAM) {
+        /* Not sequential (yet): start tracking it without read-ahead. */
+        s = lru;
+        s->dev = dev;
+        s->window = 0;
+        s->ra_end = blockno + 1;
+    } else if (s->window == 0) {
+        /* Second block in a row: the stream is sequential. */
+        s->window = RA_MIN;
+        ra_issue(dev, blockno + 1, blockno + 1 + s->window);
+        s->ra_end = blockno + 1 + s->window;
+    } else if (s->ra_end - (blockno + 1) < s->window / 2) {
+        /* The reader used up half the window: double it and refill. */
+        s->window = MIN(s->window * 2, (uint32_t) RA_MAX);
+        ra_issue(dev, MAX(s->ra_end, blockno + 1), blockno + 1 + s->window);
+        s->ra_end = blockno + 1 + s->window;
+    }
+    s->next = blockno + 1;
+    s->last_use = ++ra_clock;
+}
+
+/* bread() for a device in memory: a held buffer mapping the block. */
+static int bread_mapped(struct blk_dev *dev, uint32_t blockno,
+        struct buf **bufp)
+{
+    struct buf *b;
+
+    if ((uint64_t) blockno * BLKSECTS >= dev->nsectors)
+        return -E_INVAL;
+    if (!(b = hash_find(dev, blockno))) {
+        if (!(b = arc_header()))
+            return -E_NO_MEM;
+        b->b_dev = dev;
+        b->b_blockno = blockno;
+        b->b_flags = B_VALID | B_MAPPED;
+        b->b_refcnt = 0;
+        b->b_data = (char *) dev->mem + (size_t) blockno * BLKSIZE;
+        hash_insert(b);
+        list_move(ARC_MAPPED, b);
+    }
+    b->b_refcnt++;
+    *bufp = b;
+    return 0;
+}
+
+/* Return a held buffer with the contents of block 'blockno' of 'dev'. */
+int bread(struct blk_dev *dev, uint32_t blockno, struct buf **bufp)
+{
+    struct buf *b;
+    int r;
+
+    if (dev->mem)
+        return bread_mapped(dev, blockno, bufp);
+
+    if ((r = arc_access(dev, blockno, false, &b)) < 0)
+        return r;
+    b->b_refcnt++;
+
+    if (!(b->b_flags & (B_VALID | B_BUSY)))
+        buf_start_io(b, false);
+    ra_update(dev, blockno);
+    if ((r = buf_wait(b)) < 0 || !(b->b_flags & B_VALID)) {
+        b->b_refcnt--;
+        return r < 0 ? r : -E_IO;
+    }
+    *bufp = b;
+    return 0;
+}
+
+/* Like bread(), for a block the caller is about to overwrite completely:
+ * the buffer is valid at once, without reading the disk. */
+int bget(struct blk_dev *dev, uint32_t blockno, struct buf **bufp)
+{
+    struct buf *b;
+    int r;
+
+    if (dev->mem)
+        return bread_mapped(dev, blockno, bufp);
+    if ((r = arc_access(dev, blockno, false, &b)) < 0)
+        return r;
+    b->b_refcnt++;
+
+    /* A read in flight would land on top of the new contents. */
+    buf_wait(b);
+    b->b_flags |= B_VALID;
+    *bufp = b;
+    return 0;
+}
+
+static void bcache_maybe_flush(void)
+{
+    uint64_t age;
+
+    if (!bc_ndirty)
+        return;
+    age = read_tsc() - bc_dirty_since;
+    if (bc_ndirty > BCACHE_DIRTY_MAX ||
+        (tsc_freq && age > BCACHE_FLUSH_SEC * tsc_freq))
+        bflush(NULL);
+}
+
+/* Mark a held buffer as modified.  It reaches the disk later. */
+void bwrite(struct buf *b)
+{
+    assert(b->b_refcnt > 0 && (b->b_flags & B_VALID));
+
+    /* Written in place already. */
+    if (b->b_flags & B_MAPPED)
+        return;
+    if (!(b->b_flags & B_DIRTY)) {
+        if (!bc_ndirty)
+            bc_dirty_since = read_tsc();
+        b->b_flags |= B_DIRTY;
+        bc_ndirty++;
+    }
+}
+
+void brelse(struct buf *b)
+{
+    assert(b->b_refcnt > 0);
+    if (--b->b_refcnt == 0 && (b->b_flags & B_MAPPED)) {
+        b->b_data = NULL;
+        b->b_flags = 0;
+        arc_discard(b);
+    }
+    bcache_maybe_flush();
+}
+
+/* Write back every dirty buffer of 'dev', or of all devices if 'dev' is
+ * NULL.  All writes are queued before waiting, so the elevator can merge
+ * neighbouring blocks into large transfers. */
+int bflush(struct blk_dev *dev)
+{
+    struct buf *b;
+    int l, r = 0;
+
+    /* Mark the writes to wait for: those started here and those already
+     * in flight.  Other requests' errors, such as a read that failed long
+     * ago, are not the flush's. */
+    bc_stats.flushes++;
+    for (l = ARC_T1; l <= ARC_T2; l++)
+        for (b = bc_lists[l].b_next; b != &bc_lists[l]; b = b->b_next) {
+            if (dev && b->b_dev != dev)
+                continue;
+            if ((b->b_flags & B_DIRTY) && !(b->b_flags & B_BUSY)) {
+                buf_start_io(b, true);
+                b->b_flags |= B_FLUSH;
+            } else if ((b->b_flags & B_BUSY) && b->b_req.rq_write)
+                b->b_flags |= B_FLUSH;
+        }
+
+    for (l = ARC_T1; l <= ARC_T2; l++)
+        for (b = bc_lists[l].b_next; b != &bc_lists[l]; b = b->b_next)
+            if (b->b_flags & B_FLUSH) {
+                b->b_flags &= ~B_FLUSH;
+                if (buf_wait(b) < 0)
+                    r = -E_IO;
+            }
+
+    if (bc_ndirty)
+        bc_dirty_since = read_tsc();
+    return r;
+}
+
+void bcache_get_stats(struct bcache_stats *st)
+{
+    int i;
+
+    *st = bc_stats;
+    st->c = BCACHE_NBUF;
+    st->p = bc_p;
+    for (i = 0; i < 4; i++)
+        st->len[i] = bc_len[i];
+    st->ndirty = bc_ndirty;
+}
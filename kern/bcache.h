@@ -0,0 +1,73 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_BCACHE_H
+#define JOS_KERN_BCACHE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+#include <kern/blk.h>
+
+#define BLKSIZE         PGSIZE                  /* bytes per cached block */
+#define BLKSECTS        (BLKSIZE / SECTSIZE)    /* sectors per block */
+
+#define BCACHE_NBUF     256     /* resident buffers (cache size 'c') */
+
+/* Buffer flags */
+#define B_VALID         0x1     /* b_data holds the block's contents */
+#define B_DIRTY         0x2     /* b_data must be written back */
+#define B_BUSY          0x4     /* I/O in flight */
+#define B_READAHEAD     0x8     /* read ahead, not accessed yet */
+#define B_MAPPED        0x10    /* b_data points into the device's memory */
+#define B_FLUSH         0x20    /* a write bflush() is waiting for */
+
+/*
+ * A cached disk block.  Resident buffers own one page_alloc'd page of data;
+ * ghost buffers (recently evicted, kept only to steer ARC) have none.
+ * Blocks of a device in memory (dev->mem) are not copied: their buffers
+ * point straight at the block and last only while someone holds them.
+ */
+struct buf {
+    struct blk_dev *b_dev;
+    uint32_t b_blockno;
+    uint32_t b_flags;
+    int b_refcnt;               /* holders; referenced buffers stay put */
+    struct page_info *b_page;
+    void *b_data;               /* page2kva(b_page), or NULL for ghosts */
+
+    int b_list;                 /* ARC list the buffer is on */
+    struct buf *b_prev;         /* ARC list links, MRU first */
+    struct buf *b_next;
+    struct buf *b_hnext;        /* hash chain */
+
+    struct blk_req b_req;       /* the buffer's I/O request */
+};
+
+struct bcache_stats {
+    uint64_t hits;              /* found resident */
+    uint64_t misses;            /* had to be read */
+    uint64_t ghost_hits[2];     /* misses that were in B1 / B2 */
+    uint64_t evictions;
+    uint64_t writebacks;        /* dirty blocks written */
+    uint64_t flushes;
+    uint64_t ra_issued;         /* blocks read ahead */
+    uint64_t ra_used;           /* ... and later read */
+    uint64_t ra_wasted;         /* ... and evicted unread */
+    uint32_t c;                 /* cache size in buffers */
+    uint32_t p;                 /* ARC target size of T1 */
+    uint32_t len[4];            /* lengths of T1, T2, B1, B2 */
+    uint32_t ndirty;
+};
+
+void bcache_init(void);
+int bread(struct blk_dev *dev, uint32_t blockno, struct buf **bufp);
+int bget(struct blk_dev *dev, uint32_t blockno, struct buf **bufp);
+void bwrite(struct buf *b);
+void brelse(struct buf *b);
+int bflush(struct blk_dev *dev);
+void bcache_get_stats(struct bcache_stats *st);
+
+#endif /* !JOS_KERN_BCACHE_H */
@@ -0,0 +1,293 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Generic block device layer.
+ *
+ * Drivers register a struct blk_dev and only ever see whole transfers.  The
+ * layer keeps the per-device request queue sorted by sector, serves it in
+ * C-LOOK elevator order and merges requests that are adjacent on disk into a
+ * single transfer of up to max_nsect sectors.
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/blk.h>
+#include <kern/pmap.h>
+#include <kern/tsc.h>
+
+static struct blk_dev *blk_devs[BLK_MAXDEV];
+static int blk_ndevs;
+
+void blk_register(struct blk_dev *dev)
+{
+    if (blk_ndevs == BLK_MAXDEV) {
+        warn("blk_register: too many devices, ignoring %s", dev->name);
+        return;
+    }
+    assert(dev->max_nsect > 0 && dev->depth > 0);
+
+    dev->queue = NULL;
+    dev->inflight = 0;
+    dev->head_pos = 0;
+    blk_devs[blk_ndevs++] = dev;
+
+    cprintf("blk: %s, %llu sectors (%llu MB)\n", dev->name, dev->nsectors,
+            dev->nsectors / (1024 * 1024 / SECTSIZE));
+}
+
+struct blk_dev *blk_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < blk_ndevs; i++)
+        if (strcmp(blk_devs[i]->name, name) == 0)
+            return blk_devs[i];
+    return NULL;
+}
+
+/* Return the i'th registered device, or NULL past the last one. */
+struct blk_dev *blk_get(int i)
+{
+    return i < blk_ndevs ? blk_devs[i] : NULL;
+}
+
+/* Complete every request of the transfer starting at 'req', without starting
+ * new transfers. */
+static void blk_finish(struct blk_dev *dev, struct blk_req *req, int status)
+{
+    struct blk_req *next;
+
+    dev->inflight--;
+    for (; req; req = next) {
+        next = req->rq_next;
+        req->rq_next = NULL;
+        if (status < 0)
+            dev->st_errors++;
+        else
+            dev->st_sectors += req->rq_nsect;
+        req->rq_status = status;
+        if (req->rq_end)
+            req->rq_end(req);
+    }
+}
+
+/* Start transfers until the queue is empty or the driver is saturated. */
+static void blk_dispatch(struct blk_dev *dev)
+{
+    struct blk_req **pp, *req, *last, *next;
+    uint32_t nsect, nseg;
+    int r, started = 0;
+
+    while (dev->queue && dev->inflight < dev->depth) {
+        /* C-LOOK: take the first request at or past the head position, or
+         * sweep back to the lowest sector when there is none. */
+        for (pp = &dev->queue; *pp; pp = &(*pp)->rq_next)
+            if ((*pp)->rq_sector >= dev->head_pos)
+                break;
+        if (!*pp)
+            pp = &dev->queue;
+
+        /* Merge the requests that continue it on disk. */
+        req = last = *pp;
+        nsect = req->rq_nsect;
+        nseg = 1;
+        while ((next = last->rq_next) &&
+               next->rq_write == req->rq_write &&
+               next->rq_sector == last->rq_sector + last->rq_nsect &&
+               nsect + next->rq_nsect <= dev->max_nsect &&
+               (!dev->max_segs || nseg < dev->max_segs)) {
+            nsect += next->rq_nsect;
+            nseg++;
+            last = next;
+            dev->st_merged++;
+        }
+        *pp = last->rq_next;
+        last->rq_next = NULL;
+
+        dev->head_pos = req->rq_sector + nsect;
+        dev->inflight++;
+        dev->st_xfers++;
+        if ((r = dev->ops->start(dev, req)) < 0)
+            blk_finish(dev, req, r);
+        else
+            started++;
+    }
+    if (started && dev->ops->commit)
+        dev->ops->commit(dev);
+}
+
+/* Queue 'req' on 'dev'.  The request completes asynchronously; use blk_wait()
+ * or an rq_end callback to find out when. */
+void blk_submit(struct blk_dev *dev, struct blk_req *req)
+{
+    struct blk_req **pp;
+
+    assert(req->rq_nsect > 0 && req->rq_nsect <= dev->max_nsect);
+
+    dev->st_reqs++;
+    req->rq_next = NULL;
+    if (req->rq_sector + req->rq_nsect > dev->nsectors) {
+        req->rq_status = -E_INVAL;
+        if (req->rq_end)
+            req->rq_end(req);
+        return;
+    }
+    req->rq_status = 1;
+
+    /* Insert after any request for the same sector, so those stay in
+     * submission order. */
+    for (pp = &dev->queue; *pp; pp = &(*pp)->rq_next)
+        if ((*pp)->rq_sector > req->rq_sector)
+            break;
+    req->rq_next = *pp;
+    *pp = req;
+
+    blk_dispatch(dev);
+}
+
+/* Called by drivers when the transfer starting at 'req' has finished. */
+void blk_complete(struct blk_dev *dev, struct blk_req *req, int status)
+{
+    blk_finish(dev, req, status);
+    blk_dispatch(dev);
+}
+
+void blk_poll(struct blk_dev *dev)
+{
+    dev->ops->poll(dev);
+}
+
+/* Wait for 'req' to complete and return its status. */
+int blk_wait(struct blk_dev *dev, struct blk_req *req)
+{
+    while (req->rq_status > 0)
+        blk_poll(dev);
+    return req->rq_status;
+}
+
+/* Synchronously transfer 'nsect' sectors starting at 'sector'. */
+int blk_rw(struct blk_dev *dev, uint64_t sector, void *buf, uint32_t nsect,
+        bool write)
+{
+    struct blk_req req;
+    uint32_t n;
+    int r;
+
+    while (nsect > 0) {
+        n = MIN(nsect, dev->max_nsect);
+        memset(&req, 0, sizeof(req));
+        req.rq_sector = sector;
+        req.rq_nsect = n;
+        req.rq_write = write;
+        req.rq_buf = buf;
+        blk_submit(dev, &req);
+        if ((r = blk_wait(dev, &req)) < 0)
+            return r;
+        sector += n;
+        buf = (char *) buf + n * SECTSIZE;
+        nsect -= n;
+    }
+    return 0;
+}
+
+
+/***************************************************************
+ * Disk throughput benchmark.
+ ***************************************************************/
+
+#define BENCH_NREQ      64                  /* requests queued per batch */
+#define BENCH_NSECT     (PGSIZE / SECTSIZE) /* sectors per request */
+
+static uint32_t bench_seed = 0x2545F491;
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift32 */
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static uint64_t bench_report(struct blk_dev *dev, const char *what,
+        uint64_t bytes, uint64_t cycles, uint64_t xfers, uint64_t reqs)
+{
+    uint64_t usec = tsc_to_usec(cycles);
+    uint64_t kbps = usec ? bytes * 1000000 / 1024 / usec : 0;
+
+    cprintf("%s: %-10s %6llu.%01llu MB/s  %llu KB in %llu us, "
+            "%llu transfers for %llu requests\n",
+            dev->name, what, kbps / 1024, (kbps % 1024) * 10 / 1024,
+            bytes / 1024, usec, xfers, reqs);
+    return kbps;
+}
+
+/* Read batches of BENCH_NREQ page-sized requests, either consecutive (so the
+ * elevator can merge them) or at random page-aligned positions, and report
+ * the throughput in *kbps.  Only reads, so it is safe on any disk. */
+static int bench_run(struct blk_dev *dev, struct page_info **bufs,
+        uint64_t nbatch, bool random, uint64_t *kbps)
+{
+    struct blk_req reqs[BENCH_NREQ];
+    uint64_t npos = dev->nsectors / BENCH_NSECT;
+    uint64_t pos = 0, t0, xfers, nreqs, b;
+    int i, r;
+
+    memset(reqs, 0, sizeof(reqs));
+    xfers = dev->st_xfers;
+    nreqs = dev->st_reqs;
+    t0 = read_tsc();
+    for (b = 0; b < nbatch; b++) {
+        for (i = 0; i < BENCH_NREQ; i++) {
+            if (random)
+                pos = bench_rand() % npos;
+            else if (pos == npos)
+                pos = 0;
+            reqs[i].rq_sector = (random ? pos : pos++) * BENCH_NSECT;
+            reqs[i].rq_nsect = BENCH_NSECT;
+            reqs[i].rq_buf = page2kva(bufs[i]);
+            blk_submit(dev, &reqs[i]);
+        }
+        for (i = 0; i < BENCH_NREQ; i++)
+            if ((r = blk_wait(dev, &reqs[i])) < 0)
+                return r;
+    }
+    *kbps = bench_report(dev, random ? "random" : "sequential",
+            nbatch * BENCH_NREQ * PGSIZE, read_tsc() - t0,
+            dev->st_xfers - xfers, dev->st_reqs - nreqs);
+    return 0;
+}
+
+void blk_bench(struct blk_dev *dev, uint32_t mbytes,
+        struct blk_bench_result *res)
+{
+    struct page_info *bufs[BENCH_NREQ];
+    uint64_t nbatch;
+    int i, r = 0;
+
+    memset(res, 0, sizeof(*res));
+
+    if (dev->nsectors < BENCH_NREQ * BENCH_NSECT) {
+        cprintf("%s: device too small for the benchmark\n", dev->name);
+        return;
+    }
+
+    for (i = 0; i < BENCH_NREQ; i++)
+        if (!(bufs[i] = page_alloc(0))) {
+            cprintf("%s: benchmark: %e\n", dev->name, -E_NO_MEM);
+            goto out;
+        }
+
+    nbatch = MAX((uint64_t) mbytes * 1024 * 1024 / (BENCH_NREQ * PGSIZE),
+                 (uint64_t) 1);
+    if ((r = bench_run(dev, bufs, nbatch, false, &res->seq_kbps)) < 0 ||
+        (r = bench_run(dev, bufs, nbatch, true, &res->rand_kbps)) < 0)
+        cprintf("%s: benchmark: %e\n", dev->name, r);
+
+out:
+    while (--i >= 0)
+        page_free(bufs[i]);
+}
@@ -0,0 +1,104 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_BLK_H
+#define JOS_KERN_BLK_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define SECTSIZE        512     /* bytes per disk sector */
+
+#define BLK_MAXDEV      8       /* maximum number of registered devices */
+
+struct blk_dev;
+
+/*
+ * A block I/O request: transfer rq_nsect sectors starting at rq_sector to or
+ * from the kernel buffer rq_buf.
+ *
+ * Requests are queued with blk_submit() and complete asynchronously; the
+ * driver reports completion through blk_complete(), which sets rq_status and
+ * calls rq_end (if any).  Callers must not queue overlapping requests, since
+ * the elevator is free to reorder them.
+ */
+struct blk_req {
+    uint64_t rq_sector;         /* first sector */
+    uint32_t rq_nsect;          /* number of sectors */
+    bool rq_write;              /* write to the device instead of read */
+    void *rq_buf;               /* kernel VA of rq_nsect * SECTSIZE bytes */
+
+    /* 1 while the request is in flight, then 0 or a negative error. */
+    volatile int rq_status;
+
+    /* Optional completion callback, run from blk_complete(). */
+    void (*rq_end)(struct blk_req *req);
+    void *rq_priv;              /* owner's data for rq_end */
+
+    /* Link in the device queue while pending, or to the next request of the
+     * same merged transfer once dispatched. */
+    struct blk_req *rq_next;
+};
+
+/* Operations a block driver provides. */
+struct blk_ops {
+    /* Start a transfer covering 'req' and the requests chained behind it
+     * through rq_next, which the block layer guarantees are contiguous on
+     * disk, of the same direction and at most max_segs long.  Returns 0 or
+     * -E_IO. */
+    int (*start)(struct blk_dev *dev, struct blk_req *req);
+
+    /* Check the hardware for finished transfers and report them with
+     * blk_complete().  Called while waiting on a request. */
+    void (*poll)(struct blk_dev *dev);
+
+    /* Optional: called after a batch of start() calls, so a driver can
+     * tell the hardware about all of them at once. */
+    void (*commit)(struct blk_dev *dev);
+};
+
+struct blk_dev {
+    const char *name;
+    uint64_t nsectors;          /* device capacity */
+    uint32_t max_nsect;         /* largest transfer the driver accepts */
+    uint32_t max_segs;          /* most requests per transfer, 0 if any */
+    int depth;                  /* transfers the driver can keep in flight */
+    const struct blk_ops *ops;
+    void *priv;                 /* driver's data */
+    void *mem;                  /* contents, for a device in memory */
+
+    /* Managed by the block layer. */
+    struct blk_req *queue;      /* pending requests, sorted by sector */
+    int inflight;               /* transfers started but not completed */
+    uint64_t head_pos;          /* sector after the last dispatched one */
+
+    /* Statistics. */
+    uint64_t st_reqs;           /* requests submitted */
+    uint64_t st_merged;         /* requests merged into another transfer */
+    uint64_t st_xfers;          /* transfers started */
+    uint64_t st_sectors;        /* sectors transferred */
+    uint64_t st_errors;         /* requests failed */
+};
+
+void blk_register(struct blk_dev *dev);
+struct blk_dev *blk_lookup(const char *name);
+struct blk_dev *blk_get(int i);
+
+void blk_submit(struct blk_dev *dev, struct blk_req *req);
+void blk_complete(struct blk_dev *dev, struct blk_req *req, int status);
+void blk_poll(struct blk_dev *dev);
+int blk_wait(struct blk_dev *dev, struct blk_req *req);
+int blk_rw(struct blk_dev *dev, uint64_t sector, void *buf, uint32_t nsect,
+        bool write);
+
+/* Throughput measured by blk_bench(), in KB/s; 0 if the run failed. */
+struct blk_bench_result {
+    uint64_t seq_kbps;
+    uint64_t rand_kbps;
+};
+
+void blk_bench(struct blk_dev *dev, uint32_t mbytes,
+        struct blk_bench_result *res);
+
+#endif /* !JOS_KERN_BLK_H */
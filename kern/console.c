@@ -395,6 +395,9 @@ int cons_getc(void)
 {
     int c;
 
+    /* Whoever waits for input wants to see the output so far. */
+    cons_flush();
+
     /* Poll for any pending input characters, so that this function works even
      * when interrupts are disabled (e.g., when called from the kernel
      * monitor). */
@@ -411,9 +414,40 @@ int cons_getc(void)
     return 0;
 }
 
-/* Output a character to the console. */
+/***** Output sinks *****/
+
+/* A device attached after cons_init() that all output goes to instead of
+ * the serial and parallel ports and the CGA screen, or NULL.  The ports
+ * and the CGA cursor cost VM exits per byte; a sink such as the virtio
+ * console can batch. */
+static const struct cons_sink *cons_sink;
+
+/* Route console output to 'sink', or back to the ports if it is NULL. */
+void cons_set_sink(const struct cons_sink *sink)
+{
+    if (sink)
+        cprintf("Console output moves to %s\n", sink->name);
+    cons_sink = sink;
+    if (!sink)
+        cprintf("Console output moves back to the serial port and screen\n");
+}
+
+/* Push out anything the sink has buffered.  Called at the end of each
+ * cprintf(). */
+void cons_flush(void)
+{
+    if (cons_sink)
+        cons_sink->flush();
+}
+
+/* Output a character to the console.  With a sink, that is all: the CGA
+ * echo alone would cost a VM exit per byte for the cursor. */
 static void cons_putc(int c)
 {
+    if (cons_sink) {
+        cons_sink->putc(c);
+        return;
+    }
     serial_putc(c);
     lpt_putc(c);
     cga_putc(c);
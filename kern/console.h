@@ -17,8 +17,19 @@
 #define CRT_COLS    80
 #define CRT_SIZE    (CRT_ROWS * CRT_COLS)
 
+/* An output device that takes over console output from the serial and
+ * parallel ports and the CGA screen.  putc may buffer; flush must push
+ * everything out. */
+struct cons_sink {
+    const char *name;
+    void (*putc)(int c);
+    void (*flush)(void);
+};
+
 void cons_init(void);
 int cons_getc(void);
+void cons_set_sink(const struct cons_sink *sink);
+void cons_flush(void);
 
 void kbd_intr(void);    /* irq 1 */
 void serial_intr(void); /* irq 4 */
@@ -0,0 +1,188 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * ELF program images loaded on demand.
+ *
+ * Opening an image only checks its program headers, so it costs the same
+ * for a 10MB binary as for a 10KB one.  The contents come in a page at a
+ * time when the program first touches them: the page-fault handler asks
+ * elf_image_page() what backs the faulting page and either maps the image
+ * page itself read-only, when the image is page-aligned in memory (a
+ * Multiboot module, say) and the page is all text or read-only data, or
+ * allocates a page and has elf_image_fill() copy it in.  Pages that are all
+ * BSS need no image at all; the loader can map zeroed pages for them up
+ * front.
+ *
+ * Segments must have p_offset and p_va congruent modulo PGSIZE, as any
+ * linker arranges, so that a page of the program is a page of the file.
+ *
+ * Images may be compressed (inc/zbin.h), as the build links KERN_BINFILES.
+ * A page of the program is then a chunk of the image, decompressed straight
+ * into the new page; pieces of chunks, for headers and for pages that
+ * segments share, come from the last chunk decompressed.
+ */
+
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+
+#include <kern/elfimg.h>
+
+/* The last chunk decompressed, for reads of less than a chunk */
+static struct {
+    const struct zbin_hdr *zbin;
+    uint32_t chunk;
+    int len;
+    uint8_t buf[ZBIN_CHUNK];
+} zcache;
+
+/* Copy 'n' bytes at offset 'off' in the (decompressed) image to 'dst'. */
+static int elf_image_read(const struct elf_image *img, uint32_t off,
+                          void *dst, uint32_t n)
+{
+    uint8_t *d = dst;
+    uint32_t i, coff, len;
+    int r;
+
+    if (off > img->size || n > img->size - off)
+        return -E_INVAL;
+    if (!img->zbin) {
+        memcpy(dst, img->data + off, n);
+        return 0;
+    }
+
+    for (; n > 0; off += len, d += len, n -= len) {
+        i = off / ZBIN_CHUNK;
+        coff = off % ZBIN_CHUNK;
+        len = MIN(n, ZBIN_CHUNK - coff);
+        if (coff == 0 && len == ZBIN_CHUNK) {
+            if ((r = zbin_chunk(img->zbin, i, d)) < 0)
+                return r;
+            continue;
+        }
+        if (zcache.zbin != img->zbin || zcache.chunk != i) {
+            zcache.zbin = NULL;
+            if ((r = zbin_chunk(img->zbin, i, zcache.buf)) < 0)
+                return r;
+            zcache.zbin = img->zbin;
+            zcache.chunk = i;
+            zcache.len = r;
+        }
+        if (coff + len > (uint32_t) zcache.len)
+            return -E_INVAL;
+        memcpy(d, zcache.buf + coff, len);
+    }
+    return 0;
+}
+
+int elf_image_open(struct elf_image *img, const void *data, size_t size)
+{
+    struct elf elf;
+    struct elf_proghdr seg;
+    int i, j, r;
+
+    memset(img, 0, sizeof(*img));
+    img->data = data;
+    img->size = size;
+    if (size >= sizeof(uint32_t) && *(const uint32_t *) data == ZBIN_MAGIC) {
+        if ((r = zbin_check(data, size)) < 0)
+            return r;
+        img->zbin = data;
+        img->size = r;
+    }
+
+    if (elf_image_read(img, 0, &elf, sizeof(elf)) < 0 ||
+        elf.e_magic != ELF_MAGIC || elf.e_phentsize != sizeof(seg))
+        return -E_INVAL;
+    img->entry = elf.e_entry;
+
+    for (i = 0; i < elf.e_phnum; i++) {
+        if (elf_image_read(img, elf.e_phoff + i * sizeof(seg), &seg,
+                           sizeof(seg)) < 0)
+            return -E_INVAL;
+        if (seg.p_type != ELF_PROG_LOAD || seg.p_memsz == 0)
+            continue;
+        if (seg.p_filesz > seg.p_memsz ||
+            seg.p_offset > img->size ||
+            seg.p_filesz > img->size - seg.p_offset ||
+            seg.p_va >= UTOP || seg.p_memsz > UTOP - seg.p_va ||
+            PGOFF(seg.p_va) != PGOFF(seg.p_offset) ||
+            img->nseg == ELF_MAXSEG)
+            return -E_INVAL;
+
+        /* Keep the segments sorted and make sure they do not overlap. */
+        for (j = img->nseg; j > 0 && img->seg[j - 1].p_va > seg.p_va; j--)
+            img->seg[j] = img->seg[j - 1];
+        img->seg[j] = seg;
+        img->nseg++;
+        if ((j > 0 && img->seg[j - 1].p_va + img->seg[j - 1].p_memsz >
+                      seg.p_va) ||
+            (j + 1 < img->nseg && seg.p_va + seg.p_memsz >
+                                  img->seg[j + 1].p_va))
+            return -E_INVAL;
+    }
+    return 0;
+}
+
+/* Tell what backs the program's page at 'va': one of ELF_PAGE_*.  Sets
+ * *perm to the PTE permissions for the page and, if 'direct' is not NULL,
+ * *direct to the image page to map as it is, or NULL if the page must be
+ * filled in by elf_image_fill(). */
+int elf_image_page(const struct elf_image *img, uintptr_t va, int *perm,
+                   const void **direct)
+{
+    const struct elf_proghdr *seg, *only = NULL;
+    const uint8_t *p;
+    int i, kind = ELF_PAGE_NONE, nseg = 0;
+
+    va = ROUNDDOWN(va, PGSIZE);
+    *perm = PTE_U;
+    for (i = 0; i < img->nseg; i++) {
+        seg = &img->seg[i];
+        if (seg->p_va >= va + PGSIZE || seg->p_va + seg->p_memsz <= va)
+            continue;
+        if (seg->p_va < va + PGSIZE && seg->p_va + seg->p_filesz > va)
+            kind = ELF_PAGE_FILE;
+        else if (kind == ELF_PAGE_NONE)
+            kind = ELF_PAGE_ZERO;
+        if (seg->p_flags & ELF_PROG_FLAG_WRITE)
+            *perm |= PTE_W;
+        only = seg;
+        nseg++;
+    }
+
+    if (!direct)
+        return kind;
+    *direct = NULL;
+    if (!img->zbin && nseg == 1 && kind == ELF_PAGE_FILE && !(*perm & PTE_W) &&
+        va >= only->p_va && va + PGSIZE <= only->p_va + only->p_filesz) {
+        p = img->data + only->p_offset + (va - only->p_va);
+        if (PGOFF(p) == 0)
+            *direct = p;
+    }
+    return kind;
+}
+
+/* Fill the page 'dst' with the contents of the program's page at 'va'. */
+int elf_image_fill(const struct elf_image *img, uintptr_t va, void *dst)
+{
+    const struct elf_proghdr *seg;
+    uintptr_t lo, hi;
+    int i, r, found = 0;
+
+    va = ROUNDDOWN(va, PGSIZE);
+    memset(dst, 0, PGSIZE);
+    for (i = 0; i < img->nseg; i++) {
+        seg = &img->seg[i];
+        if (seg->p_va >= va + PGSIZE || seg->p_va + seg->p_memsz <= va)
+            continue;
+        found = 1;
+        lo = MAX(va, (uintptr_t) seg->p_va);
+        hi = MIN(va + PGSIZE, (uintptr_t) seg->p_va + seg->p_filesz);
+        if (lo < hi &&
+            (r = elf_image_read(img, seg->p_offset + (lo - seg->p_va),
+                                (uint8_t *) dst + (lo - va), hi - lo)) < 0)
+            return r;
+    }
+    return found ? 0 : -E_FAULT;
+}
@@ -0,0 +1,46 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_ELFIMG_H
+#define JOS_KERN_ELFIMG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/elf.h>
+#include <inc/zbin.h>
+
+#define ELF_MAXSEG      8
+
+/* A program image in kernel memory, loaded a page at a time. */
+struct elf_image {
+    const uint8_t *data;
+    const struct zbin_hdr *zbin;            /* data, if it is compressed */
+    size_t size;                            /* decompressed */
+    uintptr_t entry;
+    int nseg;
+    struct elf_proghdr seg[ELF_MAXSEG];     /* PT_LOAD segments, by p_va */
+};
+
+/* What backs a page of the program */
+#define ELF_PAGE_NONE   0       /* nothing: the fault is the program's */
+#define ELF_PAGE_ZERO   1       /* zeroes only (BSS) */
+#define ELF_PAGE_FILE   2       /* bytes of the image, maybe with zeroes */
+
+int elf_image_open(struct elf_image *img, const void *data, size_t size);
+int elf_image_page(const struct elf_image *img, uintptr_t va, int *perm,
+                   const void **direct);
+int elf_image_fill(const struct elf_image *img, uintptr_t va, void *dst);
+
+/* Open the binary linked into the kernel from KERN_BINFILES as obj/x, with
+ * the slashes in x replaced by underscores (e.g. user_hello).  The build
+ * compresses it into obj/zbin/x. */
+#define ELF_IMAGE_OPEN(img, x)                                              \
+    ({                                                                      \
+        extern uint8_t _binary_obj_zbin_##x##_start[],                      \
+                       _binary_obj_zbin_##x##_size[];                       \
+        elf_image_open((img), _binary_obj_zbin_##x##_start,                 \
+                       (size_t) _binary_obj_zbin_##x##_size);               \
+    })
+
+#endif /* !JOS_KERN_ELFIMG_H */
@@ -2,6 +2,12 @@
 #include <inc/memlayout.h>
 
 pte_t entry_pgtable[NPTENTRIES];
+pte_t mmio_pgtable[NPTENTRIES];
+pte_t vmalloc_pgtable[VMALLOCSIZE / PTSIZE][NPTENTRIES];
+
+#if VMALLOCSIZE != 4*PTSIZE
+# error "entry_pgdir installs four vmalloc page tables"
+#endif
 
 /*
  * The entry.S page directory maps the first 4MB of physical memory
@@ -11,7 +17,15 @@ pte_t entry_pgtable[NPTENTRIES];
  * table and it's enough to get us through early boot.  We also map
  * virtual addresses [0, 4MB) to physical addresses [0, 4MB); this
  * region is critical for a few instructions in entry.S and then we
- * never use it again.
+ * never use it again.  Finally, the PDE for UVPT points back at the page
+ * directory itself, so the active page tables are readable (but not
+ * writable) at UVPT from both kernel and user mode, and the MMIO window
+ * [MMIOBASE, MMIOLIM) gets its own, initially empty, page table that
+ * mmio_map_region() fills in.  So does each 4MB of the vmalloc region
+ * [VMALLOCBASE, VMALLOCLIM), for vmalloc().  These page tables exist from
+ * the start, so every page directory that copies their entries (with
+ * pgdir_copy_static_tables() in pmap.c) sees later mappings in these
+ * regions.
  *
  * Page directories (and page tables), must start on a page boundary,
  * hence the "__aligned__" attribute.  Also, because of restrictions
@@ -26,9 +40,32 @@ pde_t entry_pgdir[NPDENTRIES] = {
         = ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P,
     /* Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB). */
     [KERNBASE>>PDXSHIFT]
-        = ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P + PTE_W
+        = ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P + PTE_W,
+    /* Map the page directory itself read-only at UVPT. */
+    [UVPT>>PDXSHIFT]
+        = ((uintptr_t)entry_pgdir - KERNBASE) + PTE_P + PTE_U,
+    /* Page table for the memory-mapped I/O window. */
+    [MMIOBASE>>PDXSHIFT]
+        = ((uintptr_t)mmio_pgtable - KERNBASE) + PTE_P + PTE_W,
+    /* Page tables for the vmalloc region, one per 4MB of VMALLOCSIZE. */
+    [VMALLOCBASE>>PDXSHIFT]
+        = ((uintptr_t)vmalloc_pgtable[0] - KERNBASE) + PTE_P + PTE_W,
+    [(VMALLOCBASE>>PDXSHIFT) + 1]
+        = ((uintptr_t)vmalloc_pgtable[1] - KERNBASE) + PTE_P + PTE_W,
+    [(VMALLOCBASE>>PDXSHIFT) + 2]
+        = ((uintptr_t)vmalloc_pgtable[2] - KERNBASE) + PTE_P + PTE_W,
+    [(VMALLOCBASE>>PDXSHIFT) + 3]
+        = ((uintptr_t)vmalloc_pgtable[3] - KERNBASE) + PTE_P + PTE_W
 };
 
+/* Filled in by mmio_map_region(). */
+__attribute__((__aligned__(PGSIZE)))
+pte_t mmio_pgtable[NPTENTRIES];
+
+/* Filled in by vmalloc(). */
+__attribute__((__aligned__(PGSIZE)))
+pte_t vmalloc_pgtable[VMALLOCSIZE / PTSIZE][NPTENTRIES];
+
 /* Entry 0 of the page table maps to physical page 0,
  * entry 1 to physical page 1, etc. */
 __attribute__((__aligned__(PGSIZE)))
@@ -0,0 +1,1020 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Extent-based file system on top of the block layer and buffer cache.
+ * The on-disk format is described in inc/fs.h.
+ *
+ * The layout is chosen for large sequential transfers:
+ *
+ *  - Files map their blocks with extents, so a contiguous file costs one
+ *    extent however large it is, and reading it back is a single stream
+ *    the buffer cache reads ahead of.
+ *
+ *  - Allocation is delayed.  fs_write() to a block that has no disk block
+ *    yet only fills an anonymous page (a "delayed page").  Disk blocks are
+ *    chosen when the pages are flushed, on fs_sync() or once FS_NDELAY
+ *    pages have piled up, and then for whole runs of file blocks at once,
+ *    right after the file's previous block where possible.  A file written
+ *    in small pieces still ends up in a few long extents.
+ *
+ *  - The free-block bitmap is searched for runs: first a run of the full
+ *    length at or after the goal block, else the longest run there is.
+ *    Words that are all ones are skipped 32 blocks at a time.
+ *
+ *  - Directories are hash tables (see inc/fs.h) whose bucket count grows
+ *    by four once a bucket needs more than FS_DIR_MAXCHAIN overflow
+ *    blocks, so a lookup reads one or two blocks whatever the directory
+ *    size.
+ *
+ * Metadata goes through the buffer cache like file data and reaches the
+ * disk when the cache writes it back; there is no journal.
+ */
+
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/fs.h>
+#include <kern/bcache.h>
+#include <kern/pmap.h>
+
+#define BITS_PER_BLOCK      (FS_BLKSIZE * 8)
+#define FS_NEXTENT          (FS_NDIRECT_EXT + FS_NINDIRECT_EXT)
+
+#define FS_NDELAY           512     /* delayed pages before a flush */
+#define FS_NDHASH           127
+#define FS_DIR_NBUCKETS     1       /* buckets of a new directory */
+#define FS_DIR_MAXCHAIN     2       /* overflow blocks before it grows */
+
+static struct blk_dev *fs_dev;
+static struct fs_super fs_sb;
+static uint32_t fs_ino_hint;    /* where to look for a free inode */
+static uint32_t fs_blk_hint;    /* where the last allocation ended */
+
+
+/***************************************************************
+ * Free-block bitmap.
+ ***************************************************************/
+
+/* A position in the bitmap, holding the buffer of one bitmap block. */
+struct bm_cursor {
+    struct buf *b;
+    uint32_t bmblk;
+    bool dirty;
+};
+
+static void bm_done(struct bm_cursor *c)
+{
+    if (!c->b)
+        return;
+    if (c->dirty)
+        bwrite(c->b);
+    brelse(c->b);
+    c->b = NULL;
+    c->dirty = false;
+}
+
+/* Point '*wp' at the bitmap word holding block 'blk'. */
+static int bm_word(struct bm_cursor *c, uint32_t blk, uint32_t **wp)
+{
+    uint32_t bmblk = fs_sb.s_bitmap + blk / BITS_PER_BLOCK;
+    int r;
+
+    if (!c->b || c->bmblk != bmblk) {
+        bm_done(c);
+        if ((r = bread(fs_dev, bmblk, &c->b)) < 0)
+            return r;
+        c->bmblk = bmblk;
+    }
+    *wp = (uint32_t *) c->b->b_data + (blk % BITS_PER_BLOCK) / 32;
+    return 0;
+}
+
+struct bm_run {
+    uint32_t start;
+    uint32_t len;
+};
+
+/* Look for 'want' free blocks in a row in [from, to), recording the longest
+ * run seen in 'best'.  Returns 1 once a run is long enough. */
+static int bm_scan(struct bm_cursor *c, uint32_t from, uint32_t to,
+        uint32_t want, struct bm_run *best)
+{
+    uint32_t blk, run = 0, *w;
+    int r;
+
+    for (blk = from; blk < to; blk++) {
+        if ((r = bm_word(c, blk, &w)) < 0)
+            return r;
+        if (blk % 32 == 0 && *w == ~0U) {
+            run = 0;
+            blk += 31;
+            continue;
+        }
+        if (*w & (1U << (blk % 32))) {
+            run = 0;
+            continue;
+        }
+        if (++run > best->len) {
+            best->start = blk + 1 - run;
+            best->len = run;
+        }
+        if (run == want)
+            return 1;
+    }
+    return 0;
+}
+
+/* Find up to 'want' free blocks in a row, searching from 'goal' on and
+ * then from the start of the data area. */
+static int bm_find(uint32_t goal, uint32_t want, struct bm_run *run)
+{
+    struct bm_cursor c = { NULL, 0, false };
+    int r;
+
+    if (goal < fs_sb.s_data || goal >= fs_sb.s_nblocks)
+        goal = fs_sb.s_data;
+    run->len = 0;
+    if ((r = bm_scan(&c, goal, fs_sb.s_nblocks, want, run)) == 0)
+        r = bm_scan(&c, fs_sb.s_data, goal, want, run);
+    bm_done(&c);
+    if (r < 0)
+        return r;
+    return run->len ? 0 : -E_NO_DISK;
+}
+
+static int bm_set(uint32_t start, uint32_t len, bool used)
+{
+    struct bm_cursor c = { NULL, 0, false };
+    uint32_t blk, *w;
+    int r = 0;
+
+    for (blk = start; blk < start + len; blk++) {
+        if ((r = bm_word(&c, blk, &w)) < 0)
+            break;
+        if (used)
+            *w |= 1U << (blk % 32);
+        else
+            *w &= ~(1U << (blk % 32));
+        c.dirty = true;
+    }
+    bm_done(&c);
+    return r;
+}
+
+/* Allocate up to 'want' contiguous blocks near 'goal'. */
+static int balloc(uint32_t goal, uint32_t want, struct bm_run *run)
+{
+    int r;
+
+    if ((r = bm_find(goal, want, run)) < 0 ||
+        (r = bm_set(run->start, run->len, true)) < 0)
+        return r;
+    fs_blk_hint = run->start + run->len;
+    return 0;
+}
+
+/* Allocate a block for metadata (an extent block): the last free one.
+ * Data fills the disk upwards and each file's next run aims right after
+ * its last block, so any free block near the data is likely to be the
+ * next one some file wants. */
+static int balloc_meta(uint32_t *blkp)
+{
+    struct bm_cursor c = { NULL, 0, false };
+    uint32_t blk, *w;
+    int r;
+
+    for (blk = fs_sb.s_nblocks; blk-- > fs_sb.s_data; ) {
+        if ((r = bm_word(&c, blk, &w)) < 0)
+            goto out;
+        if (blk % 32 == 31 && *w == ~0U) {
+            blk -= 31;
+            continue;
+        }
+        if (!(*w & (1U << (blk % 32)))) {
+            *w |= 1U << (blk % 32);
+            c.dirty = true;
+            *blkp = blk;
+            goto out;
+        }
+    }
+    r = -E_NO_DISK;
+out:
+    bm_done(&c);
+    return r;
+}
+
+
+/***************************************************************
+ * Inodes and extents.
+ ***************************************************************/
+
+/* A held inode: the buffers of its inode block and of its extent block. */
+struct iref {
+    uint32_t ino;
+    struct fs_inode *ip;
+    struct buf *b;
+    struct buf *xb;             /* NULL if there is no extent block */
+};
+
+static int iref_get(uint32_t ino, struct iref *ir)
+{
+    int r;
+
+    if (ino == 0 || ino >= fs_sb.s_ninodes)
+        return -E_INVAL;
+    if ((r = bread(fs_dev, fs_sb.s_inodes + ino / FS_INODES_PER_BLOCK,
+                   &ir->b)) < 0)
+        return r;
+    ir->ino = ino;
+    ir->ip = (struct fs_inode *) ir->b->b_data + ino % FS_INODES_PER_BLOCK;
+    ir->xb = NULL;
+    if (ir->ip->i_extblk &&
+        (r = bread(fs_dev, ir->ip->i_extblk, &ir->xb)) < 0) {
+        brelse(ir->b);
+        return r;
+    }
+    return 0;
+}
+
+static void iref_put(struct iref *ir)
+{
+    if (ir->xb)
+        brelse(ir->xb);
+    brelse(ir->b);
+}
+
+static void iref_dirty(struct iref *ir)
+{
+    bwrite(ir->b);
+    if (ir->xb)
+        bwrite(ir->xb);
+}
+
+static struct fs_extent *ext_at(struct iref *ir, uint32_t i)
+{
+    if (i < FS_NDIRECT_EXT)
+        return &ir->ip->i_ext[i];
+    return (struct fs_extent *) ir->xb->b_data + (i - FS_NDIRECT_EXT);
+}
+
+/* Find the disk block behind file block 'lblk', or 0 for a hole. */
+static uint32_t bmap(struct iref *ir, uint32_t lblk)
+{
+    struct fs_extent *x;
+    uint32_t i;
+
+    for (i = 0; i < ir->ip->i_nextent; i++) {
+        x = ext_at(ir, i);
+        if (lblk < x->e_lblk)
+            break;
+        if (lblk < x->e_lblk + x->e_len)
+            return x->e_pblk + (lblk - x->e_lblk);
+    }
+    return 0;
+}
+
+static void ext_remove(struct iref *ir, uint32_t k)
+{
+    uint32_t i;
+
+    for (i = k; i + 1 < ir->ip->i_nextent; i++)
+        *ext_at(ir, i) = *ext_at(ir, i + 1);
+    ir->ip->i_nextent--;
+}
+
+/* Map file blocks [lblk, lblk+len) to disk blocks from 'pblk' on, growing
+ * a neighbouring extent when the new one continues it. */
+static int ext_add(struct iref *ir, uint32_t lblk, uint32_t pblk,
+        uint32_t len)
+{
+    struct fs_extent *prev = NULL, *next = NULL;
+    uint32_t k, n = ir->ip->i_nextent, xblk;
+    int r;
+
+    for (k = 0; k < n; k++)
+        if (ext_at(ir, k)->e_lblk > lblk)
+            break;
+    if (k > 0)
+        prev = ext_at(ir, k - 1);
+    if (k < n)
+        next = ext_at(ir, k);
+
+    if (prev && prev->e_lblk + prev->e_len == lblk &&
+        prev->e_pblk + prev->e_len == pblk) {
+        prev->e_len += len;
+        if (next && next->e_lblk == lblk + len &&
+            next->e_pblk == pblk + len) {
+            prev->e_len += next->e_len;
+            ext_remove(ir, k);
+        }
+    } else if (next && next->e_lblk == lblk + len &&
+               next->e_pblk == pblk + len) {
+        next->e_lblk = lblk;
+        next->e_pblk = pblk;
+        next->e_len += len;
+    } else {
+        if (n == FS_NEXTENT)
+            return -E_NO_DISK;
+        if (n == FS_NDIRECT_EXT && !ir->xb) {
+            if ((r = balloc_meta(&xblk)) < 0 ||
+                (r = bget(fs_dev, xblk, &ir->xb)) < 0)
+                return r;
+            memset(ir->xb->b_data, 0, FS_BLKSIZE);
+            ir->ip->i_extblk = xblk;
+        }
+        for (; n > k; n--)
+            *ext_at(ir, n) = *ext_at(ir, n - 1);
+        ext_at(ir, k)->e_lblk = lblk;
+        ext_at(ir, k)->e_pblk = pblk;
+        ext_at(ir, k)->e_len = len;
+        ir->ip->i_nextent++;
+    }
+    iref_dirty(ir);
+    return 0;
+}
+
+/* Allocate disk blocks for up to 'want' file blocks from 'lblk' on, right
+ * after the disk block of 'lblk - 1' if possible. */
+static int alloc_extent(struct iref *ir, uint32_t lblk, uint32_t want,
+        struct bm_run *run)
+{
+    uint32_t goal = lblk ? bmap(ir, lblk - 1) : 0;
+    int r;
+
+    if ((r = balloc(goal ? goal + 1 : fs_blk_hint, want, run)) < 0)
+        return r;
+    if ((r = ext_add(ir, lblk, run->start, run->len)) < 0) {
+        bm_set(run->start, run->len, false);
+        return r;
+    }
+    return 0;
+}
+
+/* Give back every block of the inode. */
+static void ext_free_all(struct iref *ir)
+{
+    struct fs_extent *x;
+    uint32_t i;
+
+    for (i = 0; i < ir->ip->i_nextent; i++) {
+        x = ext_at(ir, i);
+        bm_set(x->e_pblk, x->e_len, false);
+    }
+    if (ir->ip->i_extblk) {
+        bm_set(ir->ip->i_extblk, 1, false);
+        brelse(ir->xb);
+        ir->xb = NULL;
+        ir->ip->i_extblk = 0;
+    }
+    ir->ip->i_nextent = 0;
+    bwrite(ir->b);
+}
+
+static int inode_alloc(int type, uint32_t *inop)
+{
+    struct iref ir;
+    uint32_t i, ino;
+    int r;
+
+    for (i = 1; i < fs_sb.s_ninodes; i++) {
+        ino = fs_ino_hint + i;
+        if (ino >= fs_sb.s_ninodes)
+            ino -= fs_sb.s_ninodes - 1;
+        if ((r = iref_get(ino, &ir)) < 0)
+            return r;
+        if (ir.ip->i_type == FS_TYPE_FREE) {
+            memset(ir.ip, 0, sizeof(*ir.ip));
+            ir.ip->i_type = type;
+            ir.ip->i_nlink = 1;
+            iref_dirty(&ir);
+            iref_put(&ir);
+            fs_ino_hint = ino;
+            *inop = ino;
+            return 0;
+        }
+        iref_put(&ir);
+    }
+    return -E_NO_DISK;
+}
+
+
+/***************************************************************
+ * Delayed allocation.
+ ***************************************************************/
+
+/* A written file block that has no disk block yet. */
+struct fs_dpage {
+    uint32_t ino;
+    uint32_t lblk;
+    char *data;                 /* a page_alloc'd page, NULL if unused */
+    struct fs_dpage *hnext;
+};
+
+static struct fs_dpage fs_dpages[FS_NDELAY];
+static struct fs_dpage *fs_dhash[FS_NDHASH];
+static int fs_ndelay;
+
+static struct fs_dpage **dpage_slot(uint32_t ino, uint32_t lblk)
+{
+    return &fs_dhash[(ino * 2654435761U ^ lblk) % FS_NDHASH];
+}
+
+static struct fs_dpage *dpage_find(uint32_t ino, uint32_t lblk)
+{
+    struct fs_dpage *d;
+
+    for (d = *dpage_slot(ino, lblk); d; d = d->hnext)
+        if (d->ino == ino && d->lblk == lblk)
+            return d;
+    return NULL;
+}
+
+static int dpage_new(uint32_t ino, uint32_t lblk, struct fs_dpage **dp)
+{
+    struct fs_dpage *d, **slot;
+    struct page_info *pp;
+
+    for (d = fs_dpages; d->data; d++)
+        /* do nothing */;
+    if (!(pp = page_alloc(ALLOC_ZERO)))
+        return -E_NO_MEM;
+    slot = dpage_slot(ino, lblk);
+    d->ino = ino;
+    d->lblk = lblk;
+    d->data = page2kva(pp);
+    d->hnext = *slot;
+    *slot = d;
+    fs_ndelay++;
+    *dp = d;
+    return 0;
+}
+
+static void dpage_free(struct fs_dpage *d)
+{
+    struct fs_dpage **pp;
+
+    for (pp = dpage_slot(d->ino, d->lblk); *pp != d; pp = &(*pp)->hnext)
+        /* do nothing */;
+    *pp = d->hnext;
+    page_free(pa2page(PADDR(d->data)));
+    d->data = NULL;
+    fs_ndelay--;
+}
+
+static bool dpage_before(struct fs_dpage *a, struct fs_dpage *b)
+{
+    return a->ino < b->ino || (a->ino == b->ino && a->lblk < b->lblk);
+}
+
+/* Give every delayed page a disk block and write it to the buffer cache.
+ * Each run of consecutive file blocks is allocated in one go. */
+static int flush_delayed(void)
+{
+    struct fs_dpage *sorted[FS_NDELAY], *d;
+    struct bm_run run;
+    struct iref ir;
+    struct buf *b;
+    int i, j, k, m, n = 0, r = 0;
+
+    for (i = 0; i < FS_NDELAY; i++) {
+        if (!fs_dpages[i].data)
+            continue;
+        for (j = n++; j > 0 && dpage_before(&fs_dpages[i], sorted[j - 1]);
+             j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = &fs_dpages[i];
+    }
+
+    for (i = 0; i < n && r == 0; ) {
+        if ((r = iref_get(sorted[i]->ino, &ir)) < 0)
+            break;
+        while (i < n && sorted[i]->ino == ir.ino && r == 0) {
+            for (k = i + 1; k < n && sorted[k]->ino == ir.ino &&
+                 sorted[k]->lblk == sorted[k - 1]->lblk + 1; k++)
+                /* do nothing */;
+            while (i < k) {
+                if ((r = alloc_extent(&ir, sorted[i]->lblk, k - i, &run)) < 0)
+                    break;
+                for (m = 0; m < (int) run.len; m++, i++) {
+                    d = sorted[i];
+                    if ((r = bget(fs_dev, run.start + m, &b)) < 0)
+                        break;
+                    memmove(b->b_data, d->data, FS_BLKSIZE);
+                    bwrite(b);
+                    brelse(b);
+                    dpage_free(d);
+                }
+                if (r < 0)
+                    break;
+            }
+        }
+        iref_put(&ir);
+    }
+    return r;
+}
+
+int fs_sync(void)
+{
+    int r;
+
+    if (!fs_dev)
+        return 0;
+    if ((r = flush_delayed()) < 0)
+        return r;
+    return bflush(fs_dev);
+}
+
+
+/***************************************************************
+ * File data.
+ ***************************************************************/
+
+int fs_read(uint32_t ino, uint64_t off, void *buf, uint32_t n)
+{
+    struct fs_dpage *d;
+    struct iref ir;
+    struct buf *b;
+    uint32_t done, lblk, boff, m, pblk;
+    int r;
+
+    if (!fs_dev)
+        return -E_NOT_FOUND;
+    if ((r = iref_get(ino, &ir)) < 0)
+        return r;
+    if (off >= ir.ip->i_size)
+        n = 0;
+    else
+        n = MIN((uint64_t) n, ir.ip->i_size - off);
+
+    for (done = 0; done < n; done += m) {
+        lblk = (off + done) / FS_BLKSIZE;
+        boff = (off + done) % FS_BLKSIZE;
+        m = MIN(FS_BLKSIZE - boff, n - done);
+        if ((d = dpage_find(ino, lblk))) {
+            memmove((char *) buf + done, d->data + boff, m);
+        } else if ((pblk = bmap(&ir, lblk))) {
+            if ((r = bread(fs_dev, pblk, &b)) < 0)
+                goto out;
+            memmove((char *) buf + done, (char *) b->b_data + boff, m);
+            brelse(b);
+        } else {
+            memset((char *) buf + done, 0, m);
+        }
+    }
+    r = n;
+out:
+    iref_put(&ir);
+    return r;
+}
+
+int fs_write(uint32_t ino, uint64_t off, const void *buf, uint32_t n)
+{
+    struct fs_dpage *d;
+    struct iref ir;
+    struct buf *b;
+    uint32_t done, lblk, boff, m, pblk;
+    int r;
+
+    if (!fs_dev)
+        return -E_NOT_FOUND;
+    if ((r = iref_get(ino, &ir)) < 0)
+        return r;
+    if (ir.ip->i_type != FS_TYPE_FILE) {
+        r = -E_INVAL;
+        goto out;
+    }
+
+    for (done = 0; done < n; done += m) {
+        lblk = (off + done) / FS_BLKSIZE;
+        boff = (off + done) % FS_BLKSIZE;
+        m = MIN(FS_BLKSIZE - boff, n - done);
+        if ((pblk = bmap(&ir, lblk))) {
+            if (m == FS_BLKSIZE)
+                r = bget(fs_dev, pblk, &b);
+            else
+                r = bread(fs_dev, pblk, &b);
+            if (r < 0)
+                goto out;
+            memmove((char *) b->b_data + boff, (char *) buf + done, m);
+            bwrite(b);
+            brelse(b);
+            continue;
+        }
+
+        if (!(d = dpage_find(ino, lblk))) {
+            if (fs_ndelay == FS_NDELAY) {
+                /* The flush may give the inode an extent block: take it
+                 * again afterwards. */
+                iref_put(&ir);
+                if ((r = flush_delayed()) < 0)
+                    return r;
+                if ((r = iref_get(ino, &ir)) < 0)
+                    return r;
+                m = 0;
+                continue;
+            }
+            if ((r = dpage_new(ino, lblk, &d)) < 0)
+                goto out;
+        }
+        memmove(d->data + boff, (char *) buf + done, m);
+    }
+
+    if (off + n > ir.ip->i_size) {
+        ir.ip->i_size = off + n;
+        bwrite(ir.b);
+    }
+    r = n;
+out:
+    iref_put(&ir);
+    return r;
+}
+
+
+/***************************************************************
+ * Directories.
+ ***************************************************************/
+
+static struct fs_dirhdr *dir_hdr(struct buf *b)
+{
+    return (struct fs_dirhdr *) b->b_data;
+}
+
+static struct fs_dirent *dir_ent(struct buf *b, int i)
+{
+    return (struct fs_dirent *) b->b_data + 1 + i;
+}
+
+/* Read block 'lblk' of directory 'ir'.  Directory blocks are all allocated
+ * up front, so a hole means a corrupt inode. */
+static int dir_bread(struct iref *ir, uint32_t lblk, struct buf **bp)
+{
+    uint32_t pblk = bmap(ir, lblk);
+
+    if (!pblk)
+        return -E_INVAL;
+    return bread(fs_dev, pblk, bp);
+}
+
+/* Give directory 'ir' 'nbuckets' empty buckets. */
+static int dir_init(struct iref *ir, uint32_t nbuckets)
+{
+    struct bm_run run;
+    struct buf *b;
+    uint32_t lblk, i;
+    int r;
+
+    for (lblk = 0; lblk < nbuckets; lblk += run.len) {
+        if ((r = alloc_extent(ir, lblk, nbuckets - lblk, &run)) < 0)
+            return r;
+        for (i = 0; i < run.len; i++) {
+            if ((r = bget(fs_dev, run.start + i, &b)) < 0)
+                return r;
+            memset(b->b_data, 0, FS_BLKSIZE);
+            bwrite(b);
+            brelse(b);
+        }
+    }
+    ir->ip->i_nbuckets = nbuckets;
+    ir->ip->i_size = (uint64_t) nbuckets * FS_BLKSIZE;
+    iref_dirty(ir);
+    return 0;
+}
+
+static int dir_lookup(struct iref *ir, const char *name, int len,
+        struct fs_dirent *found)
+{
+    uint32_t hash = fs_name_hash(name, len), lblk;
+    struct fs_dirent *e;
+    struct buf *b;
+    int i, r;
+
+    lblk = hash % ir->ip->i_nbuckets;
+    do {
+        if ((r = dir_bread(ir, lblk, &b)) < 0)
+            return r;
+        for (i = 0; i < (int) FS_DIRENTS_PER_BLOCK; i++) {
+            e = dir_ent(b, i);
+            if (e->d_ino && e->d_hash == hash && e->d_namelen == len &&
+                memcmp(e->d_name, name, len) == 0) {
+                *found = *e;
+                brelse(b);
+                return 0;
+            }
+        }
+        lblk = dir_hdr(b)->h_next;
+        brelse(b);
+    } while (lblk);
+    return -E_NOT_FOUND;
+}
+
+/* Add an entry to its bucket, chaining a new overflow block to it if it is
+ * full.  Sets '*grow' if the bucket has become too long. */
+static int dir_insert(struct iref *ir, const char *name, int len,
+        uint32_t ino, int type, bool *grow)
+{
+    uint32_t hash = fs_name_hash(name, len), lblk, newblk;
+    struct fs_dirent *e;
+    struct bm_run run;
+    struct buf *b, *nb;
+    int i, chain = 0, r;
+
+    lblk = hash % ir->ip->i_nbuckets;
+    for (;;) {
+        if ((r = dir_bread(ir, lblk, &b)) < 0)
+            return r;
+        if (dir_hdr(b)->h_count < FS_DIRENTS_PER_BLOCK)
+            break;
+        if (!dir_hdr(b)->h_next) {
+            /* Chain a new overflow block at the end of the directory. */
+            newblk = ir->ip->i_size / FS_BLKSIZE;
+            if ((r = alloc_extent(ir, newblk, 1, &run)) < 0 ||
+                (r = bget(fs_dev, run.start, &nb)) < 0) {
+                brelse(b);
+                return r;
+            }
+            memset(nb->b_data, 0, FS_BLKSIZE);
+            ir->ip->i_size += FS_BLKSIZE;
+            iref_dirty(ir);
+            dir_hdr(b)->h_next = newblk;
+            bwrite(b);
+            brelse(b);
+            b = nb;
+            chain++;
+            break;
+        }
+        lblk = dir_hdr(b)->h_next;
+        brelse(b);
+        chain++;
+    }
+
+    for (i = 0; dir_ent(b, i)->d_ino; i++)
+        /* do nothing */;
+    e = dir_ent(b, i);
+    e->d_ino = ino;
+    e->d_hash = hash;
+    e->d_namelen = len;
+    e->d_type = type;
+    memmove(e->d_name, name, len);
+    dir_hdr(b)->h_count++;
+    bwrite(b);
+    brelse(b);
+    *grow = chain > FS_DIR_MAXCHAIN;
+    return 0;
+}
+
+/* Rebuild directory 'ir' with 'nbuckets' buckets: fill a scratch inode
+ * with its entries, then move the scratch inode's blocks over. */
+static int dir_rehash(struct iref *ir, uint32_t nbuckets)
+{
+    uint32_t tino, lblk, nblk = ir->ip->i_size / FS_BLKSIZE, i;
+    struct fs_dirent *e;
+    struct iref tr;
+    struct buf *b;
+    bool grow;
+    int r;
+
+    if ((r = inode_alloc(FS_TYPE_DIR, &tino)) < 0)
+        return r;
+    if ((r = iref_get(tino, &tr)) < 0)
+        return r;
+    if ((r = dir_init(&tr, nbuckets)) < 0)
+        goto fail;
+    for (lblk = 0; lblk < nblk; lblk++) {
+        if ((r = dir_bread(ir, lblk, &b)) < 0)
+            goto fail;
+        for (i = 0; i < FS_DIRENTS_PER_BLOCK && r == 0; i++) {
+            e = dir_ent(b, i);
+            if (e->d_ino)
+                r = dir_insert(&tr, e->d_name, e->d_namelen, e->d_ino,
+                               e->d_type, &grow);
+        }
+        brelse(b);
+        if (r < 0)
+            goto fail;
+    }
+
+    ext_free_all(ir);
+    ir->ip->i_nextent = tr.ip->i_nextent;
+    ir->ip->i_size = tr.ip->i_size;
+    ir->ip->i_nbuckets = tr.ip->i_nbuckets;
+    ir->ip->i_extblk = tr.ip->i_extblk;
+    memmove(ir->ip->i_ext, tr.ip->i_ext, sizeof(ir->ip->i_ext));
+    if (tr.xb) {
+        ir->xb = tr.xb;
+        tr.xb = NULL;
+    }
+    memset(tr.ip, 0, sizeof(*tr.ip));
+    iref_dirty(ir);
+    iref_dirty(&tr);
+    iref_put(&tr);
+    return 0;
+
+fail:
+    ext_free_all(&tr);
+    memset(tr.ip, 0, sizeof(*tr.ip));
+    iref_dirty(&tr);
+    iref_put(&tr);
+    return r;
+}
+
+static int dir_add(struct iref *ir, const char *name, int len, uint32_t ino,
+        int type)
+{
+    struct fs_dirent e;
+    bool grow;
+    int r;
+
+    if ((r = dir_lookup(ir, name, len, &e)) == 0)
+        return -E_FILE_EXISTS;
+    if (r != -E_NOT_FOUND)
+        return r;
+    if ((r = dir_insert(ir, name, len, ino, type, &grow)) < 0)
+        return r;
+    if (grow && (r = dir_rehash(ir, ir->ip->i_nbuckets * 4)) < 0)
+        warn("fs: cannot grow directory %u: %e", ir->ino, r);
+    return 0;
+}
+
+/* Iterate over a directory: return the entry at or after '*pos' in 'de'
+ * and advance '*pos' past it.  Returns 1, or 0 at the end. */
+int fs_readdir(uint32_t dino, uint32_t *pos, struct fs_dirent *de)
+{
+    uint32_t lblk, i;
+    struct iref ir;
+    struct buf *b;
+    int r;
+
+    if (!fs_dev)
+        return -E_NOT_FOUND;
+    if ((r = iref_get(dino, &ir)) < 0)
+        return r;
+    if (ir.ip->i_type != FS_TYPE_DIR) {
+        iref_put(&ir);
+        return -E_INVAL;
+    }
+
+    r = 0;
+    for (lblk = *pos / FS_DIRENTS_PER_BLOCK;
+         r == 0 && lblk < ir.ip->i_size / FS_BLKSIZE; lblk++) {
+        if ((r = dir_bread(&ir, lblk, &b)) < 0)
+            break;
+        for (i = *pos % FS_DIRENTS_PER_BLOCK; i < FS_DIRENTS_PER_BLOCK;
+             i++) {
+            if (dir_ent(b, i)->d_ino) {
+                *de = *dir_ent(b, i);
+                r = 1;
+                break;
+            }
+        }
+        *pos = lblk * FS_DIRENTS_PER_BLOCK + i + r;
+        brelse(b);
+    }
+    iref_put(&ir);
+    return r;
+}
+
+
+/***************************************************************
+ * Paths and the interface.
+ ***************************************************************/
+
+/* Look up the first 'plen' bytes of the absolute path 'path'. */
+static int path_lookup(const char *path, int plen, uint32_t *inop)
+{
+    const char *end = path + plen, *name;
+    uint32_t ino = FS_ROOT_INO;
+    struct fs_dirent e;
+    struct iref ir;
+    int r;
+
+    if (!fs_dev)
+        return -E_NOT_FOUND;
+    if (plen > 0 && *path != '/')
+        return -E_BAD_PATH;
+
+    while (path < end) {
+        while (path < end && *path == '/')
+            path++;
+        if (path == end)
+            break;
+        for (name = path; path < end && *path != '/'; path++)
+            /* do nothing */;
+        if (path - name > FS_NAMELEN)
+            return -E_BAD_PATH;
+
+        if ((r = iref_get(ino, &ir)) < 0)
+            return r;
+        if (ir.ip->i_type != FS_TYPE_DIR)
+            r = -E_BAD_PATH;
+        else
+            r = dir_lookup(&ir, name, path - name, &e);
+        iref_put(&ir);
+        if (r < 0)
+            return r;
+        ino = e.d_ino;
+    }
+    *inop = ino;
+    return 0;
+}
+
+int fs_lookup(const char *path, uint32_t *inop)
+{
+    return path_lookup(path, strlen(path), inop);
+}
+
+int fs_create(const char *path, int type, uint32_t *inop)
+{
+    const char *p, *name = NULL;
+    uint32_t dino, ino;
+    struct iref dir, ir;
+    int len, r;
+
+    for (p = path; *p; p++)
+        if (*p == '/')
+            name = p + 1;
+    if (!name || (type != FS_TYPE_FILE && type != FS_TYPE_DIR))
+        return -E_BAD_PATH;
+    len = strlen(name);
+    if (len == 0 || len > FS_NAMELEN)
+        return -E_BAD_PATH;
+    if ((r = path_lookup(path, name - path, &dino)) < 0 ||
+        (r = iref_get(dino, &dir)) < 0)
+        return r;
+    if (dir.ip->i_type != FS_TYPE_DIR) {
+        r = -E_BAD_PATH;
+        goto out;
+    }
+
+    if ((r = inode_alloc(type, &ino)) < 0)
+        goto out;
+    if (type == FS_TYPE_DIR) {
+        if ((r = iref_get(ino, &ir)) < 0)
+            goto out;
+        r = dir_init(&ir, FS_DIR_NBUCKETS);
+        iref_put(&ir);
+        if (r < 0)
+            goto out;
+    }
+    if ((r = dir_add(&dir, name, len, ino, type)) < 0) {
+        if (iref_get(ino, &ir) == 0) {
+            ext_free_all(&ir);
+            memset(ir.ip, 0, sizeof(*ir.ip));
+            iref_dirty(&ir);
+            iref_put(&ir);
+        }
+        goto out;
+    }
+    *inop = ino;
+out:
+    iref_put(&dir);
+    return r;
+}
+
+int fs_stat(uint32_t ino, struct fs_stat *st)
+{
+    struct iref ir;
+    int r;
+
+    if (!fs_dev)
+        return -E_NOT_FOUND;
+    if ((r = iref_get(ino, &ir)) < 0)
+        return r;
+    st->st_ino = ino;
+    st->st_type = ir.ip->i_type;
+    st->st_size = ir.ip->i_size;
+    st->st_nextent = ir.ip->i_nextent;
+    iref_put(&ir);
+    return 0;
+}
+
+int fs_mount(struct blk_dev *dev)
+{
+    struct fs_super *sb;
+    struct buf *b;
+    int r;
+
+    static_assert(sizeof(struct fs_inode) == FS_INODE_SIZE);
+    static_assert(sizeof(struct fs_dirhdr) == sizeof(struct fs_dirent));
+
+    if ((r = fs_sync()) < 0)
+        return r;
+    if ((r = bread(dev, FS_SUPER_BLOCK, &b)) < 0)
+        return r;
+    sb = b->b_data;
+    if (sb->s_magic != FS_MAGIC ||
+        sb->s_nblocks > dev->nsectors / BLKSECTS ||
+        sb->s_data >= sb->s_nblocks || sb->s_ninodes <= FS_ROOT_INO) {
+        brelse(b);
+        return -E_INVAL;
+    }
+    fs_sb = *sb;
+    brelse(b);
+
+    fs_dev = dev;
+    fs_ino_hint = FS_ROOT_INO;
+    fs_blk_hint = fs_sb.s_data;
+    cprintf("fs: %s: %u blocks, %u inodes\n", dev->name, fs_sb.s_nblocks,
+            fs_sb.s_ninodes);
+    return 0;
+}
@@ -0,0 +1,30 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FS_H
+#define JOS_KERN_FS_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/fs.h>
+
+#include <kern/blk.h>
+
+struct fs_stat {
+    uint32_t st_ino;
+    int st_type;                /* FS_TYPE_FILE or FS_TYPE_DIR */
+    uint64_t st_size;
+    uint32_t st_nextent;        /* extents mapping it (allocated blocks) */
+};
+
+int fs_mount(struct blk_dev *dev);
+int fs_sync(void);
+
+int fs_lookup(const char *path, uint32_t *inop);
+int fs_create(const char *path, int type, uint32_t *inop);
+int fs_stat(uint32_t ino, struct fs_stat *st);
+int fs_read(uint32_t ino, uint64_t off, void *buf, uint32_t n);
+int fs_write(uint32_t ino, uint64_t off, const void *buf, uint32_t n);
+int fs_readdir(uint32_t dino, uint32_t *pos, struct fs_dirent *de);
+
+#endif /* !JOS_KERN_FS_H */
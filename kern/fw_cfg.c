@@ -0,0 +1,245 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * QEMU firmware configuration interface (fw_cfg), used to load large files
+ * from the host: 'qemu -fw_cfg name=opt/data,file=data.bin'.
+ *
+ * An item is chosen by writing its selector to port 0x510 and can then be
+ * read a byte at a time from port 0x511.  That is fine for the directory
+ * but far too slow for data, so files are read with the DMA interface: the
+ * kernel writes the physical address of a descriptor to port 0x514 and QEMU
+ * copies a whole run of memory in one exit.  fw_cfg_load() allocates the
+ * pages first and merges physically adjacent ones into extents, so a file
+ * takes one DMA per extent rather than one per page.
+ *
+ * Everything fw_cfg defines is big-endian except the ID item.
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/fw_cfg.h>
+#include <kern/pmap.h>
+
+#define FW_CFG_PORT_SEL     0x510   /* Selector (16-bit) */
+#define FW_CFG_PORT_DATA    0x511   /* Data (8-bit) */
+#define FW_CFG_PORT_DMA     0x514   /* DMA descriptor address, high word */
+                                    /* ... low word at +4, which starts it */
+
+/* Items */
+#define FW_CFG_SIGNATURE    0x0000  /* "QEMU" */
+#define FW_CFG_ID           0x0001  /* Feature bits, little-endian */
+#define   FW_CFG_ID_DMA     0x2     /*   DMA interface present */
+#define FW_CFG_FILE_DIR     0x0019  /* Count, then struct fw_cfg_dir_entry */
+
+/* DMA control bits; the selector goes in the top 16 */
+#define FW_CFG_DMA_ERROR    0x01
+#define FW_CFG_DMA_READ     0x02
+#define FW_CFG_DMA_SELECT   0x08
+
+struct fw_cfg_dma_access {
+    uint32_t control;
+    uint32_t length;
+    uint64_t address;
+};
+
+struct fw_cfg_dir_entry {
+    uint32_t size;
+    uint16_t select;
+    uint16_t reserved;
+    char name[FW_CFG_NAMELEN];
+};
+
+#define FW_CFG_MAXFILES     64
+#define FW_CFG_MAXBLOBS     8
+#define FW_CFG_MAXEXT       (PGSIZE / sizeof(struct fw_cfg_extent))
+
+static bool fw_dma;
+static struct fw_cfg_file fw_files[FW_CFG_MAXFILES];
+static int fw_nfiles;
+static struct fw_cfg_blob fw_blobs[FW_CFG_MAXBLOBS];
+static volatile struct fw_cfg_dma_access fw_dma_access;
+
+static uint16_t be16(uint16_t x)
+{
+    return __builtin_bswap16(x);
+}
+
+static uint32_t be32(uint32_t x)
+{
+    return __builtin_bswap32(x);
+}
+
+static void fw_cfg_read(uint16_t select, void *buf, uint32_t len)
+{
+    outw(FW_CFG_PORT_SEL, select);
+    insb(FW_CFG_PORT_DATA, buf, len);
+}
+
+/* Read 'len' bytes of the current item, or of item 'select' from its start
+ * if FW_CFG_DMA_SELECT is in 'control', into [pa, pa+len). */
+static int fw_cfg_dma_read(uint32_t control, physaddr_t pa, uint32_t len)
+{
+    volatile struct fw_cfg_dma_access *d = &fw_dma_access;
+    uint32_t c;
+
+    d->control = be32(control | FW_CFG_DMA_READ);
+    d->length = be32(len);
+    d->address = __builtin_bswap64(pa);
+    outl(FW_CFG_PORT_DMA, 0);
+    outl(FW_CFG_PORT_DMA + 4, be32(PADDR((void *) d)));
+
+    /* QEMU is done before the outl() returns; the loop is for other
+     * implementations. */
+    while ((c = be32(d->control)) & ~FW_CFG_DMA_ERROR)
+        /* do nothing */;
+    return c & FW_CFG_DMA_ERROR ? -E_IO : 0;
+}
+
+void fw_cfg_init(void)
+{
+    struct fw_cfg_dir_entry e;
+    struct fw_cfg_file *f;
+    uint32_t i, n, id;
+    char sig[4];
+
+    fw_cfg_read(FW_CFG_SIGNATURE, sig, sizeof(sig));
+    if (memcmp(sig, "QEMU", sizeof(sig)) != 0)
+        return;
+    fw_cfg_read(FW_CFG_ID, &id, sizeof(id));
+    fw_dma = id & FW_CFG_ID_DMA;
+
+    fw_cfg_read(FW_CFG_FILE_DIR, &n, sizeof(n));
+    n = be32(n);
+    for (i = 0; i < n && fw_nfiles < FW_CFG_MAXFILES; i++) {
+        insb(FW_CFG_PORT_DATA, &e, sizeof(e));
+        f = &fw_files[fw_nfiles++];
+        f->size = be32(e.size);
+        f->select = be16(e.select);
+        memmove(f->name, e.name, FW_CFG_NAMELEN);
+        f->name[FW_CFG_NAMELEN - 1] = '\0';
+    }
+    cprintf("fw_cfg: %d files, %s\n", fw_nfiles, fw_dma ? "DMA" : "no DMA");
+}
+
+/* The i'th file in the directory, or NULL. */
+const struct fw_cfg_file *fw_cfg_get(int i)
+{
+    return i < fw_nfiles ? &fw_files[i] : NULL;
+}
+
+/* The loaded copy of file 'name', or NULL. */
+const struct fw_cfg_blob *fw_cfg_blob(const char *name)
+{
+    int i;
+
+    for (i = 0; i < FW_CFG_MAXBLOBS; i++)
+        if (fw_blobs[i].ext && strcmp(fw_blobs[i].file.name, name) == 0)
+            return &fw_blobs[i];
+    return NULL;
+}
+
+static void blob_free(struct fw_cfg_blob *blob)
+{
+    physaddr_t pa;
+    int i;
+
+    for (i = 0; i < blob->nextent; i++)
+        for (pa = blob->ext[i].pa;
+             pa < blob->ext[i].pa + ROUNDUP(blob->ext[i].len, PGSIZE);
+             pa += PGSIZE)
+            page_free(pa2page(pa));
+    page_free(pa2page(PADDR(blob->ext)));
+    blob->ext = NULL;
+    blob->nextent = 0;
+}
+
+/* Allocate pages for 'len' bytes, merging each page into the last extent
+ * when it sits just before or after it. */
+static int blob_alloc(struct fw_cfg_blob *blob, uint32_t len)
+{
+    struct fw_cfg_extent *x = NULL;
+    struct page_info *pp;
+    physaddr_t pa;
+    uint32_t n;
+
+    for (; len > 0; len -= n) {
+        n = MIN(len, (uint32_t) PGSIZE);
+        if (!(pp = page_alloc(0)))
+            return -E_NO_MEM;
+        pa = page2pa(pp);
+        if (x && !(x->len & (PGSIZE - 1)) && pa == x->pa + x->len) {
+            x->len += n;
+        } else if (x && n == PGSIZE && pa + PGSIZE == x->pa) {
+            x->pa = pa;
+            x->len += n;
+        } else if (blob->nextent < (int) FW_CFG_MAXEXT) {
+            x = &blob->ext[blob->nextent++];
+            x->pa = pa;
+            x->len = n;
+        } else {
+            page_free(pp);
+            return -E_NO_MEM;
+        }
+    }
+    return 0;
+}
+
+/* Copy file 'name' into memory, unless that was done already, and return
+ * the copy in '*blobp'. */
+int fw_cfg_load(const char *name, const struct fw_cfg_blob **blobp)
+{
+    const struct fw_cfg_file *f;
+    struct fw_cfg_blob *blob;
+    struct fw_cfg_extent *x;
+    struct page_info *pp;
+    uint32_t control;
+    int i, r;
+
+    if ((*blobp = fw_cfg_blob(name)))
+        return 0;
+    for (i = 0; (f = fw_cfg_get(i)); i++)
+        if (strcmp(f->name, name) == 0)
+            break;
+    if (!f)
+        return -E_NOT_FOUND;
+    for (blob = fw_blobs; blob < fw_blobs + FW_CFG_MAXBLOBS; blob++)
+        if (!blob->ext)
+            break;
+    if (blob == fw_blobs + FW_CFG_MAXBLOBS || !(pp = page_alloc(0)))
+        return -E_NO_MEM;
+
+    blob->file = *f;
+    blob->ext = page2kva(pp);
+    blob->nextent = 0;
+    if ((r = blob_alloc(blob, f->size)) < 0)
+        goto fail;
+
+    /* The first extent selects the file, the others continue reading it. */
+    control = FW_CFG_DMA_SELECT | (uint32_t) f->select << 16;
+    for (i = 0; i < blob->nextent; i++) {
+        x = &blob->ext[i];
+        if (fw_dma) {
+            if ((r = fw_cfg_dma_read(control, x->pa, x->len)) < 0)
+                goto fail;
+            control = 0;
+        } else {
+            if (i == 0)
+                outw(FW_CFG_PORT_SEL, f->select);
+            insb(FW_CFG_PORT_DATA, KADDR(x->pa), x->len);
+        }
+    }
+    if (blob->nextent) {
+        x = &blob->ext[blob->nextent - 1];
+        memset((char *) KADDR(x->pa) + x->len, 0,
+               ROUNDUP(x->len, PGSIZE) - x->len);
+    }
+    *blobp = blob;
+    return 0;
+
+fail:
+    blob_free(blob);
+    return r;
+}
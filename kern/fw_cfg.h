@@ -0,0 +1,39 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FW_CFG_H
+#define JOS_KERN_FW_CFG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define FW_CFG_NAMELEN  56
+
+/* A file in QEMU's fw_cfg directory ('qemu -fw_cfg name=opt/x,file=y'). */
+struct fw_cfg_file {
+    uint32_t size;
+    uint16_t select;
+    char name[FW_CFG_NAMELEN];
+};
+
+/* A run of physically contiguous pages holding part of a loaded file. */
+struct fw_cfg_extent {
+    physaddr_t pa;
+    uint32_t len;               /* bytes */
+};
+
+/* A file copied into page_alloc'd memory: its contents are the extents in
+ * order, the last one padded with zeroes to a page. */
+struct fw_cfg_blob {
+    struct fw_cfg_file file;
+    int nextent;
+    struct fw_cfg_extent *ext;  /* one page_alloc'd page */
+};
+
+void fw_cfg_init(void);
+const struct fw_cfg_file *fw_cfg_get(int i);
+int fw_cfg_load(const char *name, const struct fw_cfg_blob **blobp);
+const struct fw_cfg_blob *fw_cfg_blob(const char *name);
+
+#endif /* !JOS_KERN_FW_CFG_H */
@@ -0,0 +1,242 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Coverage and profile counters, for kernels built with 'make GCOV=1'.
+ *
+ * -fprofile-arcs has the compiler count the runs of every arc of every
+ * function's control flow graph, and give each object file a constructor
+ * that hands its counters to __gcov_init().  In place of libgcov, which
+ * writes .gcda files at exit, the kernel keeps the list and the monitor's
+ * 'gcov' command writes the counters, in .gcda format, to QEMU's debug
+ * console.  'make GCOV=1 qemu' saves that stream in obj/gcov.out and
+ * 'make gcda' splits it into .gcda files beside the objects, for gcov(1)
+ * and for a 'make PGO=1' build.  The stream is a series of
+ *
+ *    gcov <.gcda file name> <size>\n
+ *    <size> bytes of .gcda data
+ *
+ * This file is built without instrumentation.  The compiler's structures
+ * are those of GCC 4.7 and later, which differ in a few version-dependent
+ * details; the object summary is in the form of GCC 9 and later.
+ */
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+
+#include <kern/gcov.h>
+
+typedef uint32_t gcov_unsigned_t;
+typedef int64_t gcov_type;
+
+/* Kinds of counter the compiler knows of, whether used or not */
+#if __GNUC__ >= 14
+#define GCOV_COUNTERS   9
+#elif __GNUC__ >= 10
+#define GCOV_COUNTERS   8
+#elif __GNUC__ >= 7
+#define GCOV_COUNTERS   9
+#elif __GNUC__ > 5 || (__GNUC__ == 5 && __GNUC_MINOR__ >= 1)
+#define GCOV_COUNTERS   10
+#else
+#define GCOV_COUNTERS   9
+#endif
+
+/* .gcda record lengths count bytes from GCC 12 on, words before. */
+#if __GNUC__ >= 12
+#define GCOV_UNIT       4
+#else
+#define GCOV_UNIT       1
+#endif
+
+#define GCOV_DATA_MAGIC         0x67636461  /* "gcda" */
+#define GCOV_TAG_FUNCTION       0x01000000
+#define GCOV_TAG_FUNCTION_LEN   3
+#define GCOV_TAG_COUNTER(i)     (0x01A10000 + ((uint32_t) (i) << 17))
+#define GCOV_TAG_OBJECT_SUMMARY 0xA1000000
+#define GCOV_TAG_SUMMARY_LEN    2
+#define GCOV_COUNTER_ARCS       0   /* the arc counters, always in use */
+
+struct gcov_ctr_info {
+    gcov_unsigned_t num;
+    gcov_type *values;
+};
+
+struct gcov_info;
+
+struct gcov_fn_info {
+    const struct gcov_info *key;    /* the object that owns the function */
+    gcov_unsigned_t ident;
+    gcov_unsigned_t lineno_checksum;
+    gcov_unsigned_t cfg_checksum;
+    struct gcov_ctr_info ctrs[];    /* one per counter kind in use */
+};
+
+struct gcov_info {
+    gcov_unsigned_t version;
+    struct gcov_info *next;
+    gcov_unsigned_t stamp;
+#if __GNUC__ >= 12
+    gcov_unsigned_t checksum;
+#endif
+    const char *filename;
+    /* Non-NULL for the counter kinds in use */
+    void (*merge[GCOV_COUNTERS])(gcov_type *, gcov_unsigned_t);
+    gcov_unsigned_t n_functions;
+    const struct gcov_fn_info *const *functions;
+};
+
+static struct gcov_info *gcov_objects;
+
+/* Called by the constructor of every instrumented object. */
+void __gcov_init(struct gcov_info *info)
+{
+    info->next = gcov_objects;
+    gcov_objects = info;
+}
+
+/* Referenced from the objects' tables and destructors, never called */
+void __gcov_merge_add(gcov_type *counters, gcov_unsigned_t n)
+{
+}
+
+void __gcov_exit(void)
+{
+}
+
+int gcov_nobjects(void)
+{
+    struct gcov_info *info;
+    int n = 0;
+
+    for (info = gcov_objects; info; info = info->next)
+        n++;
+    return n;
+}
+
+/* Append a word to an object's .gcda data, or just count it if !emit. */
+static uint32_t gcov_put(uint32_t v, bool emit)
+{
+    int i;
+
+    if (emit)
+        for (i = 0; i < 4; i++)
+            outb(GCOV_DEBUGCON, v >> (i * 8));
+    return 4;
+}
+
+/* The largest arc counter of an object, for its summary */
+static gcov_type gcov_sum_max(const struct gcov_info *info)
+{
+    const struct gcov_fn_info *fn;
+    const struct gcov_ctr_info *ctr;
+    gcov_type max = 0;
+    uint32_t f, n;
+
+    for (f = 0; f < info->n_functions; f++) {
+        fn = info->functions[f];
+        if (!fn || fn->key != info)
+            continue;
+        ctr = &fn->ctrs[GCOV_COUNTER_ARCS];
+        for (n = 0; n < ctr->num; n++)
+            max = MAX(max, ctr->values[n]);
+    }
+    return max;
+}
+
+/* Write an object's .gcda data and return its size. */
+static uint32_t gcov_write(const struct gcov_info *info, bool emit)
+{
+    const struct gcov_fn_info *fn;
+    const struct gcov_ctr_info *ctr;
+    uint32_t f, n, t, size = 0;
+
+    size += gcov_put(GCOV_DATA_MAGIC, emit);
+    size += gcov_put(info->version, emit);
+    size += gcov_put(info->stamp, emit);
+#if __GNUC__ >= 12
+    size += gcov_put(info->checksum, emit);
+#endif
+
+    /* The object summary: one run.  -fprofile-use scales the counts by it
+     * and ignores a file without one. */
+    size += gcov_put(GCOV_TAG_OBJECT_SUMMARY, emit);
+    size += gcov_put(GCOV_TAG_SUMMARY_LEN * GCOV_UNIT, emit);
+    size += gcov_put(1, emit);
+    size += gcov_put(gcov_sum_max(info), emit);
+
+    for (f = 0; f < info->n_functions; f++) {
+        fn = info->functions[f];
+        size += gcov_put(GCOV_TAG_FUNCTION, emit);
+        /* Functions the linker discarded (one copy of an inline, say)
+         * get an empty record. */
+        if (!fn || fn->key != info) {
+            size += gcov_put(0, emit);
+            continue;
+        }
+        size += gcov_put(GCOV_TAG_FUNCTION_LEN * GCOV_UNIT, emit);
+        size += gcov_put(fn->ident, emit);
+        size += gcov_put(fn->lineno_checksum, emit);
+        size += gcov_put(fn->cfg_checksum, emit);
+
+        ctr = fn->ctrs;
+        for (t = 0; t < GCOV_COUNTERS; t++) {
+            if (!info->merge[t])
+                continue;
+            size += gcov_put(GCOV_TAG_COUNTER(t), emit);
+            size += gcov_put(ctr->num * 2 * GCOV_UNIT, emit);
+            for (n = 0; n < ctr->num; n++) {
+                size += gcov_put(ctr->values[n], emit);
+                size += gcov_put((uint64_t) ctr->values[n] >> 32, emit);
+            }
+            ctr++;
+        }
+    }
+    return size;
+}
+
+/* Write every object's counters to the debug console.  Returns the number
+ * of objects. */
+int gcov_dump(void)
+{
+    struct gcov_info *info;
+    char hdr[256];
+    int n = 0, i, len;
+
+    for (info = gcov_objects; info; info = info->next) {
+        len = snprintf(hdr, sizeof(hdr), "gcov %s %u\n", info->filename,
+                       gcov_write(info, 0));
+        if (len >= (int) sizeof(hdr)) {
+            cprintf("gcov: %s: name too long\n", info->filename);
+            continue;
+        }
+        for (i = 0; i < len; i++)
+            outb(GCOV_DEBUGCON, hdr[i]);
+        gcov_write(info, 1);
+        n++;
+    }
+    return n;
+}
+
+/* Zero the counters, to profile just what runs next. */
+void gcov_reset(void)
+{
+    const struct gcov_info *info;
+    const struct gcov_fn_info *fn;
+    const struct gcov_ctr_info *ctr;
+    uint32_t f, n, t;
+
+    for (info = gcov_objects; info; info = info->next)
+        for (f = 0; f < info->n_functions; f++) {
+            fn = info->functions[f];
+            if (!fn || fn->key != info)
+                continue;
+            ctr = fn->ctrs;
+            for (t = 0; t < GCOV_COUNTERS; t++) {
+                if (!info->merge[t])
+                    continue;
+                for (n = 0; n < ctr->num; n++)
+                    ctr->values[n] = 0;
+                ctr++;
+            }
+        }
+}
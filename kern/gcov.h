@@ -0,0 +1,18 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_GCOV_H
+#define JOS_KERN_GCOV_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* Port of QEMU's debug console (-debugcon), where the counters go */
+#define GCOV_DEBUGCON   0xE9
+
+int gcov_nobjects(void);
+int gcov_dump(void);
+void gcov_reset(void);
+
+#endif /* !JOS_KERN_GCOV_H */
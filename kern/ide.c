@@ -0,0 +1,294 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * PIO driver for the disks on the primary ATA (IDE) channel.
+ *
+ * This speaks the same protocol as readsect() in boot/main.c, extended with
+ * LBA48 addressing and multi-sector transfers.  A transfer is started by
+ * ide_start() and then advanced one sector at a time by ide_intr(), the
+ * IRQ 14 handler.  Until the kernel takes interrupts, ide_intr() is driven
+ * from the block layer's poll hook instead.
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/ata.h>
+#include <kern/blk.h>
+#include <kern/ide.h>
+
+#define IDE_IOBASE      0x1F0   /* Command block registers */
+#define IDE_DATA        0       /* Data (32-bit PIO) */
+#define IDE_ERROR       1       /* In:  Error */
+#define IDE_NSECT       2       /* Sector count */
+#define IDE_LBA0        3       /* LBA bits 0-7 (24-31 on LBA48 1st write) */
+#define IDE_LBA1        4       /* LBA bits 8-15 (32-39) */
+#define IDE_LBA2        5       /* LBA bits 16-23 (40-47) */
+#define IDE_DEVICE      6       /* Drive select and LBA bits 24-27 */
+#define   IDE_DEV_LBA   0x40    /*   LBA addressing */
+#define   IDE_DEV_OBS   0xA0    /*   Obsolete bits, set by convention */
+#define IDE_STATUS      7       /* In:  Status (reading acks the IRQ) */
+#define IDE_CMD         7       /* Out: Command */
+#define   IDE_BSY       0x80    /*   Busy */
+#define   IDE_DRDY      0x40    /*   Drive ready */
+#define   IDE_DF        0x20    /*   Drive fault */
+#define   IDE_DRQ       0x08    /*   Data request */
+#define   IDE_ERR       0x01    /*   Error */
+#define IDE_ALTSTATUS   0x3F6   /* Alternate status, does not ack the IRQ */
+
+#define IDE_PROBE_SPIN      100000  /* status polls before giving up a probe */
+
+struct ide_disk {
+    struct blk_dev dev;
+    int unit;                   /* 0 = master, 1 = slave */
+    bool lba48;
+    struct blk_req *deferred;   /* transfer waiting for the channel */
+};
+
+static struct ide_disk ide_disks[2];
+
+/* The transfer the channel is working on.  Both drives share the channel, so
+ * only one of them can have a command outstanding. */
+static struct {
+    struct ide_disk *disk;      /* owner of the transfer, NULL when idle */
+    struct blk_req *head;       /* first request of the transfer */
+    struct blk_req *req;        /* request holding the next sector */
+    uint32_t off;               /* next sector within req */
+    uint32_t left;              /* sectors still to move */
+} ide_chan;
+
+/* Give the drive the 400ns it needs to update the status register. */
+static void ide_delay(void)
+{
+    inb(IDE_ALTSTATUS);
+    inb(IDE_ALTSTATUS);
+    inb(IDE_ALTSTATUS);
+    inb(IDE_ALTSTATUS);
+}
+
+/* Wait for the drive to leave the busy state and return its status, or -1 if
+ * it does not within 'spin' polls (0 means wait forever). */
+static int ide_wait(int spin)
+{
+    int r;
+
+    while ((r = inb(IDE_IOBASE + IDE_STATUS)) & IDE_BSY)
+        if (spin && --spin == 0)
+            return -1;
+    return r;
+}
+
+static bool ide_probe(struct ide_disk *disk)
+{
+    uint16_t id[SECTSIZE / 2];
+    int r, spin;
+
+    outb(IDE_IOBASE + IDE_DEVICE, IDE_DEV_OBS | (disk->unit << 4));
+    ide_delay();
+    outb(IDE_IOBASE + IDE_NSECT, 0);
+    outb(IDE_IOBASE + IDE_LBA0, 0);
+    outb(IDE_IOBASE + IDE_LBA1, 0);
+    outb(IDE_IOBASE + IDE_LBA2, 0);
+    outb(IDE_IOBASE + IDE_CMD, ATA_CMD_IDENTIFY);
+    ide_delay();
+
+    /* 0 means no drive, 0xFF a floating bus without a controller. */
+    r = inb(IDE_IOBASE + IDE_STATUS);
+    if (r == 0 || r == 0xFF)
+        return false;
+    if ((r = ide_wait(IDE_PROBE_SPIN)) < 0)
+        return false;
+
+    /* ATAPI devices abort IDENTIFY and leave a signature in LBA1/LBA2. */
+    if (inb(IDE_IOBASE + IDE_LBA1) || inb(IDE_IOBASE + IDE_LBA2))
+        return false;
+    /* A floating bus or a confused device may raise neither: no disk. */
+    for (spin = IDE_PROBE_SPIN; !(r & (IDE_DRQ | IDE_ERR)); spin--) {
+        if (spin == 0)
+            return false;
+        r = inb(IDE_IOBASE + IDE_STATUS);
+    }
+    if (r & IDE_ERR)
+        return false;
+    insl(IDE_IOBASE + IDE_DATA, id, SECTSIZE / 4);
+
+    disk->lba48 = id[ATA_ID_FEATURES] & ATA_ID_LBA48;
+    disk->dev.nsectors = ata_id_nsectors(id);
+    return disk->dev.nsectors > 0;
+}
+
+/* Move one sector between the drive and the current request buffer. */
+static void ide_xfer_sector(void)
+{
+    struct blk_req *req = ide_chan.req;
+    void *buf = (char *) req->rq_buf + ide_chan.off * SECTSIZE;
+
+    if (req->rq_write)
+        outsl(IDE_IOBASE + IDE_DATA, buf, SECTSIZE / 4);
+    else
+        insl(IDE_IOBASE + IDE_DATA, buf, SECTSIZE / 4);
+    ide_delay();
+
+    if (++ide_chan.off == req->rq_nsect) {
+        ide_chan.req = req->rq_next;
+        ide_chan.off = 0;
+    }
+    ide_chan.left--;
+}
+
+/* Program the channel for the transfer starting at 'req'. */
+static int ide_issue(struct ide_disk *disk, struct blk_req *req)
+{
+    struct blk_req *r;
+    uint64_t sector = req->rq_sector;
+    uint32_t nsect = 0;
+    int unit = disk->unit << 4;
+    int status;
+
+    for (r = req; r; r = r->rq_next)
+        nsect += r->rq_nsect;
+
+    ide_wait(0);
+    if (disk->lba48 && (sector + nsect > (1 << 28) || nsect > 256)) {
+        /* LBA48: high-order bytes first, then low-order through the same
+         * registers.  A count of 0 means 65536. */
+        outb(IDE_IOBASE + IDE_DEVICE, IDE_DEV_LBA | unit);
+        outb(IDE_IOBASE + IDE_NSECT, nsect >> 8);
+        outb(IDE_IOBASE + IDE_LBA0, sector >> 24);
+        outb(IDE_IOBASE + IDE_LBA1, sector >> 32);
+        outb(IDE_IOBASE + IDE_LBA2, sector >> 40);
+        outb(IDE_IOBASE + IDE_NSECT, nsect);
+        outb(IDE_IOBASE + IDE_LBA0, sector);
+        outb(IDE_IOBASE + IDE_LBA1, sector >> 8);
+        outb(IDE_IOBASE + IDE_LBA2, sector >> 16);
+        outb(IDE_IOBASE + IDE_CMD,
+             req->rq_write ? ATA_CMD_WRITE_EXT : ATA_CMD_READ_EXT);
+    } else {
+        /* LBA28, as in boot/main.c.  A count of 0 means 256. */
+        outb(IDE_IOBASE + IDE_DEVICE, IDE_DEV_OBS | IDE_DEV_LBA | unit |
+             ((sector >> 24) & 0x0F));
+        outb(IDE_IOBASE + IDE_NSECT, nsect);
+        outb(IDE_IOBASE + IDE_LBA0, sector);
+        outb(IDE_IOBASE + IDE_LBA1, sector >> 8);
+        outb(IDE_IOBASE + IDE_LBA2, sector >> 16);
+        outb(IDE_IOBASE + IDE_CMD,
+             req->rq_write ? ATA_CMD_WRITE : ATA_CMD_READ);
+    }
+    ide_delay();
+
+    ide_chan.disk = disk;
+    ide_chan.head = ide_chan.req = req;
+    ide_chan.off = 0;
+    ide_chan.left = nsect;
+
+    /* Writes raise no interrupt for the first sector: the drive just asks
+     * for the data with DRQ. */
+    if (req->rq_write) {
+        while (((status = ide_wait(0)) & (IDE_DRQ | IDE_ERR | IDE_DF)) == 0)
+            /* do nothing */;
+        if (status & (IDE_ERR | IDE_DF)) {
+            ide_chan.disk = NULL;
+            return -E_IO;
+        }
+        ide_xfer_sector();
+    }
+    return 0;
+}
+
+/* The channel's transfer is over: hand it back to the block layer and give
+ * the channel to a transfer that was waiting for it. */
+static void ide_done(int status)
+{
+    struct ide_disk *disk = ide_chan.disk;
+    struct blk_req *req = ide_chan.head;
+    struct ide_disk *next;
+    struct blk_req *nreq;
+    int i, r;
+
+    ide_chan.disk = NULL;
+    for (i = 1; i <= 2; i++) {
+        next = &ide_disks[(disk->unit + i) % 2];
+        if (!(nreq = next->deferred))
+            continue;
+        next->deferred = NULL;
+        if ((r = ide_issue(next, nreq)) < 0)
+            blk_complete(&next->dev, nreq, r);
+        else
+            break;
+    }
+    blk_complete(&disk->dev, req, status);
+}
+
+void ide_intr(void)
+{
+    int status;
+
+    if (!ide_chan.disk)
+        return;
+
+    /* Reading the status register also acknowledges the interrupt. */
+    status = inb(IDE_IOBASE + IDE_STATUS);
+    if (status & IDE_BSY)
+        return;
+    if (status & (IDE_ERR | IDE_DF)) {
+        warn("ide%d: error %02x at sector %llu", ide_chan.disk->unit,
+             inb(IDE_IOBASE + IDE_ERROR), ide_chan.head->rq_sector);
+        ide_done(-E_IO);
+        return;
+    }
+
+    /* Reads interrupt when the next sector is ready; writes when the drive
+     * wants the next one, and once more after the last. */
+    if (ide_chan.left > 0) {
+        if (!(status & IDE_DRQ))
+            return;
+        ide_xfer_sector();
+        if (ide_chan.left > 0 || ide_chan.head->rq_write)
+            return;
+    }
+    ide_done(0);
+}
+
+static int ide_start(struct blk_dev *dev, struct blk_req *req)
+{
+    struct ide_disk *disk = dev->priv;
+
+    if (ide_chan.disk) {
+        assert(!disk->deferred);
+        disk->deferred = req;
+        return 0;
+    }
+    return ide_issue(disk, req);
+}
+
+static void ide_poll(struct blk_dev *dev)
+{
+    ide_intr();
+}
+
+static const struct blk_ops ide_ops = {
+    .start = ide_start,
+    .poll = ide_poll,
+};
+
+void ide_init(void)
+{
+    static const char *names[] = { "ide0", "ide1" };
+    struct ide_disk *disk;
+    int unit;
+
+    for (unit = 0; unit < 2; unit++) {
+        disk = &ide_disks[unit];
+        disk->unit = unit;
+        if (!ide_probe(disk))
+            continue;
+
+        disk->dev.name = names[unit];
+        disk->dev.max_nsect = disk->lba48 ? 65536 : 256;
+        disk->dev.depth = 1;
+        disk->dev.ops = &ide_ops;
+        disk->dev.priv = disk;
+        blk_register(&disk->dev);
+    }
+}
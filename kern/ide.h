@@ -0,0 +1,12 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IDE_H
+#define JOS_KERN_IDE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+void ide_init(void);
+void ide_intr(void);    /* irq 14 */
+
+#endif /* !JOS_KERN_IDE_H */
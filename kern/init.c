@@ -7,25 +7,49 @@
 #include <kern/monitor.h>
 #include <kern/console.h>
 #include <kern/pmap.h>
+#include <kern/multiboot.h>
+#include <kern/ramdisk.h>
+#include <kern/fw_cfg.h>
 #include <kern/kclock.h>
+#include <kern/tsc.h>
+#include <kern/ide.h>
+#include <kern/pci.h>
+#include <kern/bcache.h>
 
 
-void i386_init(void)
+void i386_init(uint32_t mb_magic, physaddr_t mb_info)
 {
     extern char edata[], end[];
+    extern void (*__ctors_start[])(void), (*__ctors_end[])(void);
+    void (**ctor)(void);
 
     /* Before doing anything else, complete the ELF loading process.
      * Clear the uninitialized global data (BSS) section of our program.
      * This ensures that all static/global variables start out zero. */
     memset(edata, 0, end - edata);
 
+    /* Run the constructors: only the GCOV=1 build has any (kern/gcov.c). */
+    for (ctor = __ctors_start; ctor < __ctors_end; ctor++)
+        (*ctor)();
+
     /* Initialize the console.
      * Can't call cprintf until after we do this! */
     cons_init();
 
+    /* Find the Multiboot modules before memory is handed out. */
+    multiboot_init(mb_magic, mb_info);
+
     /* Lab 1 memory management initialization functions */
     mem_init();
 
+    /* Timing, PCI devices and the buffer cache */
+    tsc_init();
+    ide_init();
+    pci_init();
+    ramdisk_init();
+    fw_cfg_init();
+    bcache_init();
+
     /* Drop into the kernel monitor. */
     while (1)
         monitor(NULL);
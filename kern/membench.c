@@ -0,0 +1,281 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Memory bandwidth and latency benchmark.
+ *
+ * For working sets from 4KB up to the size asked for, doubling each time,
+ * measure the bandwidth of sequential reads, writes (memset) and copies
+ * (memcpy, half the set to the other half), and with SSE2 the same with
+ * 16-byte loads and non-temporal stores.  Then measure the latency of a
+ * load by chasing pointers through the set's cache lines in a random
+ * cycle, so that every load waits for the one before and the prefetcher
+ * cannot guess the next.  As the set outgrows each cache level the curve
+ * steps down (bandwidth) and up (latency).
+ *
+ * The set is made of page_alloc'd pages reached through the direct map,
+ * so it needs no contiguous memory and can be as big as free memory.
+ */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/error.h>
+
+#include <kern/pmap.h>
+#include <kern/vmalloc.h>
+#include <kern/tsc.h>
+#include <kern/membench.h>
+
+#define CPUID_SSE2      (1 << 26)
+
+#define MB_MINBYTES     (16 * 1024 * 1024)  /* moved per bandwidth test */
+#define MB_MINSTEPS     (1 << 20)           /* loads per latency test */
+#define MB_LINESIZE     64                  /* bytes per cache line */
+#define MB_LINES        (PGSIZE / MB_LINESIZE)
+
+/* Results the compiler must not optimise away */
+static volatile uintptr_t mb_sink;
+
+static uint32_t mb_seed = 0x2545F491;
+
+static uint32_t mb_rand(void)
+{
+    /* xorshift32 */
+    mb_seed ^= mb_seed << 13;
+    mb_seed ^= mb_seed >> 17;
+    mb_seed ^= mb_seed << 5;
+    return mb_seed;
+}
+
+/* Byte 'off' of the working set */
+static char *mb_addr(void **pg, size_t off)
+{
+    return (char *) pg[off / PGSIZE] + off % PGSIZE;
+}
+
+/* Cache line 'i' of the working set */
+static void **mb_line(void **pg, uint32_t i)
+{
+    return (void **) ((char *) pg[i / MB_LINES] +
+                      (i % MB_LINES) * MB_LINESIZE);
+}
+
+static void mb_read(void *dst, const void *src, size_t n)
+{
+    const uint32_t *p = src, *end = p + n / sizeof(*p);
+    uint32_t sum = 0;
+
+    for (; p < end; p += 4)
+        sum += p[0] + p[1] + p[2] + p[3];
+    mb_sink = sum;
+}
+
+static void mb_write(void *dst, const void *src, size_t n)
+{
+    memset(dst, 0xA5, n);
+}
+
+static void mb_copy(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+/* The SSE2 versions move 64 bytes at a time, which must be aligned.  The
+ * kernel is built without SSE, so the compiler neither uses the XMM
+ * registers nor lets asm name them as clobbered. */
+static void sse_read(void *dst, const void *src, size_t n)
+{
+    const char *p;
+
+    for (p = src; p < (const char *) src + n; p += 64)
+        asm volatile("movdqa (%0), %%xmm0\n\t"
+                     "movdqa 16(%0), %%xmm1\n\t"
+                     "movdqa 32(%0), %%xmm2\n\t"
+                     "movdqa 48(%0), %%xmm3"
+                     : : "r" (p));
+}
+
+/* Non-temporal stores, which bypass the caches */
+static void sse_write(void *dst, const void *src, size_t n)
+{
+    char *p;
+
+    asm volatile("pxor %%xmm0, %%xmm0" : :);
+    for (p = dst; p < (char *) dst + n; p += 64)
+        asm volatile("movntdq %%xmm0, (%0)\n\t"
+                     "movntdq %%xmm0, 16(%0)\n\t"
+                     "movntdq %%xmm0, 32(%0)\n\t"
+                     "movntdq %%xmm0, 48(%0)"
+                     : : "r" (p) : "memory");
+    asm volatile("sfence" : : : "memory");
+}
+
+static void sse_copy(void *dst, const void *src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i += 64)
+        asm volatile("movdqa (%1), %%xmm0\n\t"
+                     "movdqa 16(%1), %%xmm1\n\t"
+                     "movdqa 32(%1), %%xmm2\n\t"
+                     "movdqa 48(%1), %%xmm3\n\t"
+                     "movntdq %%xmm0, (%0)\n\t"
+                     "movntdq %%xmm1, 16(%0)\n\t"
+                     "movntdq %%xmm2, 32(%0)\n\t"
+                     "movntdq %%xmm3, 48(%0)"
+                     : : "r" ((char *) dst + i), "r" ((const char *) src + i)
+                     : "memory");
+    asm volatile("sfence" : : : "memory");
+}
+
+static const struct mb_test {
+    const char *name;
+    void (*fn)(void *dst, const void *src, size_t n);
+    bool copy;                  /* from the first half to the second */
+} mb_tests[] = {
+    { "read", mb_read, 0 },
+    { "write", mb_write, 0 },
+    { "copy", mb_copy, 1 },
+    { "sse rd", sse_read, 0 },
+    { "sse wr", sse_write, 0 },
+    { "sse cp", sse_copy, 1 },
+};
+#define MB_NTESTS       (sizeof(mb_tests) / sizeof(mb_tests[0]))
+#define MB_NPLAIN       3       /* the tests that need no SSE */
+
+/* Let the kernel use SSE2.  Nothing else in the kernel touches the XMM
+ * registers, so they need no saving. */
+static bool mb_sse_enable(void)
+{
+    uint32_t edx;
+
+    cpuid(1, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_SSE2))
+        return false;
+    lcr0((rcr0() & ~CR0_EM) | CR0_MP);
+    lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    return true;
+}
+
+/* Run 'test' over the first 'size' bytes of the working set until it has
+ * moved at least MB_MINBYTES, and return the rate in KB/s. */
+static uint64_t mb_run(const struct mb_test *test, void **pg, size_t size)
+{
+    size_t span = test->copy ? size / 2 : size;
+    size_t len = MIN(span, (size_t) PGSIZE);
+    uint64_t bytes, t0, usec;
+    size_t off;
+
+    t0 = read_tsc();
+    for (bytes = 0; bytes < MB_MINBYTES; bytes += span)
+        for (off = 0; off < span; off += len)
+            test->fn(mb_addr(pg, (test->copy ? span : 0) + off),
+                     mb_addr(pg, off), len);
+    usec = tsc_to_usec(read_tsc() - t0);
+    return usec ? bytes * 1000000 / 1024 / usec : 0;
+}
+
+/* Link the 'n' cache lines of the working set into a single cycle in
+ * random order (Sattolo's algorithm), and return the first. */
+static void *mb_chain(void **pg, uint32_t n)
+{
+    uint32_t i, j;
+    void *t;
+
+    /* Each line holds the index of the next, then its address. */
+    for (i = 0; i < n; i++)
+        *mb_line(pg, i) = (void *) i;
+    for (i = n - 1; i > 0; i--) {
+        j = mb_rand() % i;
+        t = *mb_line(pg, i);
+        *mb_line(pg, i) = *mb_line(pg, j);
+        *mb_line(pg, j) = t;
+    }
+    for (i = 0; i < n; i++)
+        *mb_line(pg, i) = mb_line(pg, (uintptr_t) *mb_line(pg, i));
+    return mb_line(pg, 0);
+}
+
+/* Follow 'nsteps' pointers from 'p', and return the cycles taken. */
+static uint64_t mb_chase(void *p, uint32_t nsteps)
+{
+    void **q = p;
+    uint64_t t0;
+    uint32_t i;
+
+    t0 = read_tsc();
+    for (i = 0; i < nsteps; i += 8) {
+        q = *q; q = *q; q = *q; q = *q;
+        q = *q; q = *q; q = *q; q = *q;
+    }
+    t0 = read_tsc() - t0;
+    mb_sink = (uintptr_t) q;
+    return t0;
+}
+
+static void mb_print_size(size_t size)
+{
+    if (size < 1024 * 1024)
+        cprintf("%5uKB", size / 1024);
+    else
+        cprintf("%5uMB", size / (1024 * 1024));
+}
+
+/* Benchmark working sets of up to 'mbytes' MB, as far as free memory
+ * allows. */
+void mem_bench(uint32_t mbytes)
+{
+    struct page_info *pp;
+    uint64_t cycles, ns10;
+    size_t npages, n, size, max;
+    uint32_t nlines, nsteps;
+    void **pg;
+    int i, ntests;
+
+    if (!tsc_freq) {
+        cprintf("membench: TSC not calibrated\n");
+        return;
+    }
+    /* No more than the direct map holds */
+    npages = MIN(mbytes, (uint32_t) -KERNBASE >> 20) * (1024 * 1024 / PGSIZE);
+    if (!(pg = vmalloc(npages * sizeof(void *), 0))) {
+        cprintf("membench: %e\n", -E_NO_MEM);
+        return;
+    }
+    for (n = 0; n < npages && (pp = page_alloc(0)); n++)
+        pg[n] = page2kva(pp);
+    if (n == 0) {
+        cprintf("membench: %e\n", -E_NO_MEM);
+        goto out;
+    }
+    for (max = PGSIZE; max * 2 <= n * PGSIZE; max *= 2)
+        /* do nothing */;
+
+    ntests = mb_sse_enable() ? MB_NTESTS : MB_NPLAIN;
+    cprintf("membench: up to %u KB, bandwidth in MB/s%s\n", max / 1024,
+            ntests == MB_NPLAIN ? " (no SSE2)" : "");
+    cprintf("%7s", "size");
+    for (i = 0; i < ntests; i++)
+        cprintf("%8s", mb_tests[i].name);
+    cprintf("%10s\n", "latency");
+
+    for (size = PGSIZE; size <= max; size *= 2) {
+        mb_print_size(size);
+        for (i = 0; i < ntests; i++)
+            cprintf("%8llu", mb_run(&mb_tests[i], pg, size) / 1024);
+
+        nlines = size / MB_LINESIZE;
+        nsteps = ROUNDUP(MAX(nlines, (uint32_t) MB_MINSTEPS), 8);
+        cycles = mb_chase(mb_chain(pg, nlines), nsteps);
+        /* tenths of a nanosecond per load */
+        ns10 = cycles * 1000 / nsteps * 10000000 / tsc_freq;
+        cprintf("%5llu.%01llu ns %4llu cycles\n", ns10 / 10, ns10 % 10,
+                cycles / nsteps);
+    }
+
+out:
+    while (n > 0)
+        page_free(pa2page(PADDR(pg[--n])));
+    vfree(pg);
+}
@@ -0,0 +1,13 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_MEMBENCH_H
+#define JOS_KERN_MEMBENCH_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+void mem_bench(uint32_t mbytes);
+
+#endif /* !JOS_KERN_MEMBENCH_H */
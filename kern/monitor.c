@@ -7,11 +7,20 @@
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
+#include <inc/error.h>
 #include <inc/x86.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/blk.h>
+#include <kern/bcache.h>
+#include <kern/pci.h>
+#include <kern/fw_cfg.h>
+#include <kern/fs.h>
+#include <kern/tsc.h>
+#include <kern/gcov.h>
+#include <kern/membench.h>
 
 #define CMDBUF_SIZE 80  /* enough for one VGA text line */
 
@@ -27,6 +36,22 @@ static struct command commands[] = {
     { "help", "Display this list of commands", mon_help },
     { "kerninfo", "Display information about the kernel", mon_kerninfo },
     { "backtrace", "Display stack backtrace", mon_backtrace },
+    { "diskbench", "Measure disk read throughput [dev] [MB]", mon_diskbench },
+    { "membench", "Measure memory bandwidth and latency [MB]",
+      mon_membench },
+    { "bcstat", "Display buffer cache statistics", mon_bcstat },
+    { "lspci", "List PCI functions and their BARs", mon_lspci },
+    { "fwcfg", "List fw_cfg files or load one [load name]", mon_fwcfg },
+    { "mount", "Mount the file system on a block device", mon_mount },
+    { "ls", "List a directory [path]", mon_ls },
+    { "cat", "Display a file", mon_cat },
+    { "mkdir", "Create a directory", mon_mkdir },
+    { "write", "Append KB of numbered lines to a file, creating it",
+      mon_write },
+    { "sync", "Write the file system's delayed and dirty blocks to disk",
+      mon_sync },
+    { "gcov", "Write coverage counters to the debug console [reset]",
+      mon_gcov },
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -88,13 +113,287 @@ int mon_backtrace(int argc, char **argv, struct trapframe *tf)
     return 0;
 }
 
+/* Print 'kbps' in MB/s, and relative to 'base' if that is known. */
+__cold static void print_speed(uint64_t kbps, uint64_t base)
+{
+    cprintf("  %6llu.%01llu MB/s", kbps / 1024, (kbps % 1024) * 10 / 1024);
+    if (base)
+        cprintf(" %4llu.%01llux", kbps / base, (kbps % base) * 10 / base);
+    else
+        cprintf("       ");
+}
+
+int mon_diskbench(int argc, char **argv, struct trapframe *tf)
+{
+    struct blk_bench_result res[BLK_MAXDEV];
+    struct blk_dev *dev;
+    uint32_t mbytes = 16;
+    int i;
+
+    if (argc > 3) {
+        cprintf("Usage: diskbench [dev] [MB]\n");
+        return 0;
+    }
+    if (argc == 3)
+        mbytes = strtol(argv[2], NULL, 0);
+
+    /* Without a device name, run on every disk and compare them with the
+     * first one. */
+    if (argc == 1) {
+        for (i = 0; (dev = blk_get(i)); i++)
+            blk_bench(dev, mbytes, &res[i]);
+        if (i == 0)
+            cprintf("No block devices\n");
+        if (i < 2)
+            return 0;
+        cprintf("%-8s  %22s  %22s\n", "device", "sequential", "random");
+        for (i = 0; (dev = blk_get(i)); i++) {
+            cprintf("%-8s", dev->name);
+            print_speed(res[i].seq_kbps, i ? res[0].seq_kbps : 0);
+            print_speed(res[i].rand_kbps, i ? res[0].rand_kbps : 0);
+            cprintf("\n");
+        }
+        return 0;
+    }
+
+    if (!(dev = blk_lookup(argv[1]))) {
+        cprintf("No such block device '%s'\n", argv[1]);
+        return 0;
+    }
+    blk_bench(dev, mbytes, &res[0]);
+    return 0;
+}
+
+int mon_membench(int argc, char **argv, struct trapframe *tf)
+{
+    uint32_t mbytes = 256;
+
+    if (argc > 2 || (argc == 2 && !(mbytes = strtol(argv[1], NULL, 0)))) {
+        cprintf("Usage: membench [MB]\n");
+        return 0;
+    }
+    mem_bench(mbytes);
+    return 0;
+}
+
+int mon_bcstat(int argc, char **argv, struct trapframe *tf)
+{
+    struct bcache_stats st;
+    uint64_t lookups;
+
+    bcache_get_stats(&st);
+    lookups = st.hits + st.misses;
+    cprintf("Buffer cache: %u buffers of %u bytes, %u dirty\n",
+            st.c, BLKSIZE, st.ndirty);
+    cprintf("  lookups %llu, hits %llu, misses %llu (%llu%% hit)\n",
+            lookups, st.hits, st.misses,
+            lookups ? st.hits * 100 / lookups : 0);
+    cprintf("  ghost hits B1 %llu, B2 %llu\n",
+            st.ghost_hits[0], st.ghost_hits[1]);
+    cprintf("  evictions %llu, writebacks %llu, flushes %llu\n",
+            st.evictions, st.writebacks, st.flushes);
+    cprintf("  read-ahead %llu, used %llu, wasted %llu\n",
+            st.ra_issued, st.ra_used, st.ra_wasted);
+    cprintf("  ARC: p %u, T1 %u, T2 %u, B1 %u, B2 %u\n",
+            st.p, st.len[0], st.len[1], st.len[2], st.len[3]);
+    return 0;
+}
+
+int mon_lspci(int argc, char **argv, struct trapframe *tf)
+{
+    struct pci_func *f;
+    int i;
+
+    for (i = 0; (f = pci_get(i)); i++)
+        pci_print_func(f);
+    return 0;
+}
+
+int mon_fwcfg(int argc, char **argv, struct trapframe *tf)
+{
+    const struct fw_cfg_file *f;
+    const struct fw_cfg_blob *blob;
+    uint64_t start, usec;
+    int i, r;
+
+    if (argc == 1) {
+        for (i = 0; (f = fw_cfg_get(i)); i++)
+            cprintf("%04x %10u  %s%s\n", f->select, f->size, f->name,
+                    fw_cfg_blob(f->name) ? " (loaded)" : "");
+        if (i == 0)
+            cprintf("No fw_cfg files\n");
+        return 0;
+    }
+    if (argc != 3 || strcmp(argv[1], "load") != 0) {
+        cprintf("Usage: fwcfg [load name]\n");
+        return 0;
+    }
+
+    start = read_tsc();
+    if ((r = fw_cfg_load(argv[2], &blob)) < 0) {
+        cprintf("fwcfg: %s: %e\n", argv[2], r);
+        return 0;
+    }
+    usec = MAX(tsc_to_usec(read_tsc() - start), 1ULL);
+    cprintf("%s: %u KB in %d extents, %llu us, %llu MB/s\n", argv[2],
+            blob->file.size / 1024, blob->nextent, usec,
+            (uint64_t) blob->file.size / usec);
+    return 0;
+}
+
+int mon_mount(int argc, char **argv, struct trapframe *tf)
+{
+    struct blk_dev *dev;
+    int r;
+
+    if (argc != 2) {
+        cprintf("Usage: mount dev\n");
+        return 0;
+    }
+    if (!(dev = blk_lookup(argv[1]))) {
+        cprintf("No such block device '%s'\n", argv[1]);
+        return 0;
+    }
+    if ((r = fs_mount(dev)) < 0)
+        cprintf("mount: %s: %e\n", argv[1], r);
+    return 0;
+}
+
+int mon_ls(int argc, char **argv, struct trapframe *tf)
+{
+    const char *path = argc > 1 ? argv[1] : "/";
+    struct fs_dirent de;
+    struct fs_stat st;
+    uint32_t ino, pos = 0;
+    int r;
+
+    if ((r = fs_lookup(path, &ino)) < 0 || (r = fs_stat(ino, &st)) < 0) {
+        cprintf("ls: %s: %e\n", path, r);
+        return 0;
+    }
+    if (st.st_type != FS_TYPE_DIR) {
+        cprintf("%10llu %3u  %s\n", st.st_size, st.st_nextent, path);
+        return 0;
+    }
+    while ((r = fs_readdir(ino, &pos, &de)) > 0) {
+        if (fs_stat(de.d_ino, &st) < 0)
+            continue;
+        cprintf("%10llu %3u  %.*s%s\n", st.st_size, st.st_nextent,
+                de.d_namelen, de.d_name, de.d_type == FS_TYPE_DIR ? "/" : "");
+    }
+    if (r < 0)
+        cprintf("ls: %s: %e\n", path, r);
+    return 0;
+}
+
+int mon_cat(int argc, char **argv, struct trapframe *tf)
+{
+    char buf[256];
+    uint32_t ino;
+    uint64_t off;
+    int i, r;
+
+    if (argc != 2) {
+        cprintf("Usage: cat path\n");
+        return 0;
+    }
+    if ((r = fs_lookup(argv[1], &ino)) < 0) {
+        cprintf("cat: %s: %e\n", argv[1], r);
+        return 0;
+    }
+    for (off = 0; (r = fs_read(ino, off, buf, sizeof(buf))) > 0; off += r)
+        for (i = 0; i < r; i++)
+            cputchar(buf[i]);
+    if (r < 0)
+        cprintf("cat: %s: %e\n", argv[1], r);
+    return 0;
+}
+
+int mon_mkdir(int argc, char **argv, struct trapframe *tf)
+{
+    uint32_t ino;
+    int r;
+
+    if (argc != 2) {
+        cprintf("Usage: mkdir path\n");
+        return 0;
+    }
+    if ((r = fs_create(argv[1], FS_TYPE_DIR, &ino)) < 0)
+        cprintf("mkdir: %s: %e\n", argv[1], r);
+    return 0;
+}
+
+/* Append 'KB' kilobytes to a file, one line of MON_LINELEN bytes at a time.
+ * Each line holds its own offset, so 'cat' shows where data went astray.
+ * The lines are much smaller than a block: the file's blocks get disk
+ * blocks only when the file system flushes its delayed pages. */
+#define MON_LINELEN     32
+
+int mon_write(int argc, char **argv, struct trapframe *tf)
+{
+    char line[MON_LINELEN + 1];
+    struct fs_stat st;
+    uint64_t off, end;
+    uint32_t ino;
+    int r;
+
+    if (argc != 3) {
+        cprintf("Usage: write path KB\n");
+        return 0;
+    }
+    if ((r = fs_lookup(argv[1], &ino)) == -E_NOT_FOUND)
+        r = fs_create(argv[1], FS_TYPE_FILE, &ino);
+    if (r < 0 || (r = fs_stat(ino, &st)) < 0) {
+        cprintf("write: %s: %e\n", argv[1], r);
+        return 0;
+    }
+
+    end = st.st_size + (uint64_t) strtol(argv[2], NULL, 0) * 1024;
+    for (off = st.st_size; off < end; off += r) {
+        snprintf(line, sizeof(line), "%0*llu\n", MON_LINELEN - 1, off);
+        if ((r = fs_write(ino, off, line,
+                          MIN((uint64_t) MON_LINELEN, end - off))) < 0) {
+            cprintf("write: %s: %e\n", argv[1], r);
+            break;
+        }
+    }
+    return 0;
+}
+
+int mon_sync(int argc, char **argv, struct trapframe *tf)
+{
+    int r;
+
+    if ((r = fs_sync()) < 0)
+        cprintf("sync: %e\n", r);
+    return 0;
+}
+
+int mon_gcov(int argc, char **argv, struct trapframe *tf)
+{
+    if (gcov_nobjects() == 0) {
+        cprintf("No coverage counters: build with GCOV=1\n");
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        gcov_reset();
+        return 0;
+    }
+    if (argc != 1) {
+        cprintf("Usage: gcov [reset]\n");
+        return 0;
+    }
+    cprintf("%d objects written to the debug console\n", gcov_dump());
+    return 0;
+}
+
 
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
 #define MAXARGS 16
 
-static int runcmd(char *buf, struct trapframe *tf)
+__cold static int runcmd(char *buf, struct trapframe *tf)
 {
     int argc;
     char *argv[MAXARGS];
@@ -4,6 +4,8 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
 struct trapframe;
 
 /*
@@ -11,11 +13,23 @@ struct trapframe;
  * optionally providing a trap frame indicating the current state
  * (NULL if none).
  */
-void monitor(struct trapframe *tf);
+__cold void monitor(struct trapframe *tf);
 
 /* Functions implementing monitor commands. */
-int mon_help(int argc, char **argv, struct trapframe *tf);
-int mon_kerninfo(int argc, char **argv, struct trapframe *tf);
-int mon_backtrace(int argc, char **argv, struct trapframe *tf);
+__cold int mon_help(int argc, char **argv, struct trapframe *tf);
+__cold int mon_kerninfo(int argc, char **argv, struct trapframe *tf);
+__cold int mon_backtrace(int argc, char **argv, struct trapframe *tf);
+__cold int mon_diskbench(int argc, char **argv, struct trapframe *tf);
+__cold int mon_membench(int argc, char **argv, struct trapframe *tf);
+__cold int mon_bcstat(int argc, char **argv, struct trapframe *tf);
+__cold int mon_lspci(int argc, char **argv, struct trapframe *tf);
+__cold int mon_fwcfg(int argc, char **argv, struct trapframe *tf);
+__cold int mon_mount(int argc, char **argv, struct trapframe *tf);
+__cold int mon_ls(int argc, char **argv, struct trapframe *tf);
+__cold int mon_cat(int argc, char **argv, struct trapframe *tf);
+__cold int mon_mkdir(int argc, char **argv, struct trapframe *tf);
+__cold int mon_write(int argc, char **argv, struct trapframe *tf);
+__cold int mon_sync(int argc, char **argv, struct trapframe *tf);
+__cold int mon_gcov(int argc, char **argv, struct trapframe *tf);
 
 #endif /* !JOS_KERN_MONITOR_H */
@@ -0,0 +1,84 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Multiboot information left by the boot loader.
+ *
+ * Booted with 'qemu -kernel obj/kern/kernel -initrd a,b', the kernel finds
+ * the files a and b loaded as modules, page-aligned, just past its own end.
+ * multiboot_init() runs before mem_init() and copies the module list out
+ * of the loader's memory, which the kernel is about to reuse; boot_alloc()
+ * then starts past the last module, so page_init() never hands the modules
+ * out.  Booted by boot/main.c there is no Multiboot information and no
+ * modules.
+ */
+
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/multiboot.h>
+#include <kern/pmap.h>
+
+static struct mb_module mb_mods[MB_MAXMODS];
+static int mb_nmods;
+static physaddr_t mb_end;
+
+/* The loader's data is in low memory, which entry_pgdir maps. */
+static void *mb_kaddr(physaddr_t pa)
+{
+    if (pa >= PTSIZE)
+        panic("multiboot: info at %08x is not mapped", pa);
+    return (void *) (pa + KERNBASE);
+}
+
+void multiboot_init(uint32_t magic, physaddr_t info)
+{
+    extern char end[];
+    struct multiboot_info *mbi;
+    struct multiboot_mod *mod;
+    struct mb_module *m;
+    uint32_t i;
+
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC)
+        return;
+    mbi = mb_kaddr(info);
+    if (!(mbi->flags & MULTIBOOT_INFO_MODS))
+        return;
+
+    mod = mb_kaddr(mbi->mods_addr);
+    for (i = 0; i < mbi->mods_count; i++, mod++) {
+        if (mb_nmods == MB_MAXMODS) {
+            cprintf("multiboot: more than %d modules, ignoring the rest\n",
+                    MB_MAXMODS);
+            break;
+        }
+        /* Only memory between the kernel and boot_alloc() stays reserved. */
+        if (mod->mod_start & (PGSIZE - 1) ||
+            mod->mod_start < PADDR(end) || mod->mod_end < mod->mod_start) {
+            cprintf("multiboot: ignoring module %u at [%08x, %08x)\n",
+                    i, mod->mod_start, mod->mod_end);
+            continue;
+        }
+        m = &mb_mods[mb_nmods++];
+        m->start = mod->mod_start;
+        m->end = mod->mod_end;
+        if (mod->string)
+            strncpy(m->name, mb_kaddr(mod->string), MB_NAMELEN - 1);
+        mb_end = MAX(mb_end, ROUNDUP(m->end, PGSIZE));
+    }
+}
+
+int multiboot_nmods(void)
+{
+    return mb_nmods;
+}
+
+const struct mb_module *multiboot_mod(int i)
+{
+    return i < mb_nmods ? &mb_mods[i] : NULL;
+}
+
+/* The first physical address past every module, or 0 if there are none. */
+physaddr_t multiboot_mods_end(void)
+{
+    return mb_end;
+}
@@ -0,0 +1,50 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_MULTIBOOT_H
+#define JOS_KERN_MULTIBOOT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* In %eax when a Multiboot loader (QEMU -kernel, GRUB) enters the kernel */
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+
+/* Multiboot information structure, found at the physical address in %ebx.
+ * Only the fields up to the module list are used. */
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+};
+
+#define MULTIBOOT_INFO_MODS     0x08    /* mods_count and mods_addr valid */
+
+struct multiboot_mod {
+    uint32_t mod_start;         /* physical address of the first byte */
+    uint32_t mod_end;           /* ... and of the byte after the last */
+    uint32_t string;            /* command line, NUL-terminated */
+    uint32_t reserved;
+};
+
+#define MB_MAXMODS      8
+#define MB_NAMELEN      32
+
+/* A module the loader left in memory. */
+struct mb_module {
+    physaddr_t start;
+    physaddr_t end;
+    char name[MB_NAMELEN];      /* its command line, truncated */
+};
+
+void multiboot_init(uint32_t magic, physaddr_t info);
+int multiboot_nmods(void);
+const struct mb_module *multiboot_mod(int i);
+physaddr_t multiboot_mods_end(void);
+
+#endif /* !JOS_KERN_MULTIBOOT_H */
@@ -0,0 +1,316 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * PCI bus enumeration.
+ *
+ * pci_init() walks configuration space through configuration mechanism #1
+ * (write the address of a register to CONFIG_ADDRESS, then access it
+ * through CONFIG_DATA), following PCI-to-PCI bridges to the buses behind
+ * them.  Every function found is recorded with its BARs sized and offered
+ * to the drivers in the attach tables below.  Drivers map the BARs they use
+ * into the MMIO window with pci_map_bar().
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/pci.h>
+#include <kern/pmap.h>
+#include <kern/ahci.h>
+#include <kern/virtio.h>
+#include <kern/virtio_blk.h>
+#include <kern/virtio_cons.h>
+
+#define PCI_CONF_ADDR       0xCF8
+#define   PCI_CONF_ENABLE   0x80000000
+#define PCI_CONF_DATA       0xCFC
+
+#define PCI_NBUS            256
+#define PCI_NDEV            32
+#define PCI_NFUNC           8
+#define PCI_MAXFUNCS        64
+
+/* MSI capability */
+#define MSI_CTL_ENABLE      0x0001
+#define MSI_CTL_MME         0x0070  /* Multiple message enable */
+#define MSI_CTL_64BIT       0x0080
+#define MSI_ADDR            0xFEE00000  /* Local APIC, destination in 19:12 */
+
+static struct pci_func pci_funcs[PCI_MAXFUNCS];
+static int pci_nfuncs;
+
+static int pci_scan_bus(uint32_t bus);
+
+static int pci_bridge_attach(struct pci_func *f)
+{
+    uint32_t busreg = pci_conf_read(f, PCI_BRIDGE_BUS_REG);
+    uint32_t secondary = (busreg >> 8) & 0xFF;
+
+    if (secondary == 0 || secondary <= f->bus) {
+        warn("pci: %02x:%02x.%d: bridge to bus %d not configured",
+             f->bus, f->dev, f->func, secondary);
+        return 0;
+    }
+    pci_scan_bus(secondary);
+    return 1;
+}
+
+/* Drivers, by (class, subclass) */
+static struct pci_driver pci_attach_class[] = {
+    { PCI_CLASS_BRIDGE, PCI_SUBCLASS_PCI, &pci_bridge_attach },
+    { PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, &ahci_attach },
+    { 0, 0, 0 },
+};
+
+/* Drivers, by (vendor, product).  Tried before the class table. */
+static struct pci_driver pci_attach_vendor[] = {
+    { VIRTIO_PCI_VENDOR, VIRTIO_PCI_BLK_TRANS, &virtio_blk_attach },
+    { VIRTIO_PCI_VENDOR, VIRTIO_PCI_MODERN(VIRTIO_ID_BLOCK),
+      &virtio_blk_attach },
+    { VIRTIO_PCI_VENDOR, VIRTIO_PCI_CONSOLE_TRANS, &virtio_cons_attach },
+    { VIRTIO_PCI_VENDOR, VIRTIO_PCI_MODERN(VIRTIO_ID_CONSOLE),
+      &virtio_cons_attach },
+    { 0, 0, 0 },
+};
+
+static void pci_conf_select(struct pci_func *f, uint32_t off)
+{
+    assert(f->bus < PCI_NBUS && f->dev < PCI_NDEV && f->func < PCI_NFUNC);
+    assert((off & 3) == 0 && off < 256);
+
+    outl(PCI_CONF_ADDR, PCI_CONF_ENABLE | f->bus << 16 | f->dev << 11 |
+         f->func << 8 | off);
+}
+
+uint32_t pci_conf_read(struct pci_func *f, uint32_t off)
+{
+    pci_conf_select(f, off);
+    return inl(PCI_CONF_DATA);
+}
+
+void pci_conf_write(struct pci_func *f, uint32_t off, uint32_t v)
+{
+    pci_conf_select(f, off);
+    outl(PCI_CONF_DATA, v);
+}
+
+/* Return the i'th function found by pci_init(), or NULL past the last. */
+struct pci_func *pci_get(int i)
+{
+    return i < pci_nfuncs ? &pci_funcs[i] : NULL;
+}
+
+/* Find each BAR's size by writing all ones and reading back which address
+ * bits stick.  Decoding is off meanwhile, so the function does not respond
+ * at the bogus address. */
+static void pci_size_bars(struct pci_func *f, int nbars)
+{
+    uint32_t cmd, off, old, mask, oldhi, maskhi;
+    int n;
+
+    cmd = pci_conf_read(f, PCI_COMMAND_REG);
+    pci_conf_write(f, PCI_COMMAND_REG,
+                   cmd & ~(PCI_CMD_IO | PCI_CMD_MEM) & 0xFFFF);
+
+    for (n = 0; n < nbars; n++) {
+        off = PCI_BAR_REG(n);
+        old = pci_conf_read(f, off);
+        pci_conf_write(f, off, ~0);
+        mask = pci_conf_read(f, off);
+        pci_conf_write(f, off, old);
+        if (mask == 0)
+            continue;
+
+        if (old & PCI_BAR_IO) {
+            /* The upper 16 bits of an I/O BAR may read as 0. */
+            mask &= ~0x3;
+            if (!(mask & 0xFFFF0000))
+                mask |= 0xFFFF0000;
+            f->reg_flags[n] = PCI_BAR_IO;
+            f->reg_base[n] = old & ~0x3;
+            f->reg_size[n] = ~mask + 1;
+            continue;
+        }
+
+        f->reg_flags[n] = old & (PCI_BAR_MEM64 | PCI_BAR_PREFETCH);
+        f->reg_base[n] = old & ~0xF;
+        f->reg_size[n] = ~(mask & ~0xF) + 1;
+        if ((old & PCI_BAR_MEM64) && n + 1 < nbars) {
+            n++;
+            off = PCI_BAR_REG(n);
+            oldhi = pci_conf_read(f, off);
+            pci_conf_write(f, off, ~0);
+            maskhi = pci_conf_read(f, off);
+            pci_conf_write(f, off, oldhi);
+            /* Out of reach of 32-bit paging, or 4GB or larger. */
+            if (oldhi || maskhi != ~0U) {
+                f->reg_base[n - 1] = f->reg_size[n - 1] = 0;
+                warn("pci: %02x:%02x.%d: BAR %d unusable", f->bus, f->dev,
+                     f->func, n - 1);
+            }
+        }
+    }
+
+    pci_conf_write(f, PCI_COMMAND_REG, cmd & 0xFFFF);
+}
+
+static int pci_attach_match(uint32_t key1, uint32_t key2,
+        struct pci_driver *list, struct pci_func *f)
+{
+    int i, r;
+
+    for (i = 0; list[i].attachfn; i++) {
+        if (list[i].key1 != key1 || list[i].key2 != key2)
+            continue;
+        if ((r = list[i].attachfn(f)) > 0)
+            return r;
+        if (r < 0)
+            warn("pci: %02x:%02x.%d: attach of %04x:%04x failed: %e",
+                 f->bus, f->dev, f->func, key1, key2, r);
+    }
+    return 0;
+}
+
+static int pci_attach(struct pci_func *f)
+{
+    return pci_attach_match(PCI_VENDOR(f->dev_id), PCI_PRODUCT(f->dev_id),
+                            pci_attach_vendor, f) ||
+        pci_attach_match(PCI_CLASS(f->dev_class), PCI_SUBCLASS(f->dev_class),
+                         pci_attach_class, f);
+}
+
+void pci_print_func(struct pci_func *f)
+{
+    int n;
+
+    cprintf("PCI: %02x:%02x.%d: %04x:%04x class %02x.%02x.%02x irq %d",
+            f->bus, f->dev, f->func, PCI_VENDOR(f->dev_id),
+            PCI_PRODUCT(f->dev_id), PCI_CLASS(f->dev_class),
+            PCI_SUBCLASS(f->dev_class), PCI_PROGIF(f->dev_class),
+            f->irq_line);
+    for (n = 0; n < PCI_NBARS; n++)
+        if (f->reg_size[n])
+            cprintf(" %s%d %x+%x",
+                    (f->reg_flags[n] & PCI_BAR_IO) ? "io" : "mem", n,
+                    f->reg_base[n], f->reg_size[n]);
+    cprintf("\n");
+}
+
+/* Record every function on 'bus' and attach drivers to them.  Returns the
+ * number of functions found. */
+static int pci_scan_bus(uint32_t bus)
+{
+    struct pci_func df, *f;
+    uint32_t bhlc, nfunc;
+    int found = 0;
+
+    memset(&df, 0, sizeof(df));
+    df.bus = bus;
+    for (df.dev = 0; df.dev < PCI_NDEV; df.dev++) {
+        df.func = 0;
+        bhlc = pci_conf_read(&df, PCI_BHLC_REG);
+        nfunc = (bhlc & PCI_HDR_MULTIFN) ? PCI_NFUNC : 1;
+
+        for (; df.func < nfunc; df.func++) {
+            df.dev_id = pci_conf_read(&df, PCI_ID_REG);
+            if (PCI_VENDOR(df.dev_id) == 0xFFFF)
+                continue;
+            if (pci_nfuncs == PCI_MAXFUNCS) {
+                warn("pci: too many functions, ignoring the rest");
+                return found;
+            }
+
+            f = &pci_funcs[pci_nfuncs++];
+            *f = df;
+            f->dev_class = pci_conf_read(f, PCI_CLASS_REG);
+            f->irq_line = pci_conf_read(f, PCI_INTR_REG) & 0xFF;
+            bhlc = pci_conf_read(f, PCI_BHLC_REG);
+            /* Type 0 headers have six BARs, bridges (type 1) two. */
+            pci_size_bars(f, PCI_HDR_TYPE(bhlc) == 0 ? PCI_NBARS :
+                          PCI_HDR_TYPE(bhlc) == 1 ? 2 : 0);
+            f->msi_cap = pci_find_cap(f, PCI_CAP_MSI, 0);
+
+            pci_print_func(f);
+            found++;
+            pci_attach(f);
+        }
+    }
+    return found;
+}
+
+void pci_init(void)
+{
+    pci_scan_bus(0);
+}
+
+/* Let the function decode its I/O and memory BARs and master the bus. */
+void pci_func_enable(struct pci_func *f)
+{
+    pci_conf_write(f, PCI_COMMAND_REG,
+                   (pci_conf_read(f, PCI_COMMAND_REG) & 0xFFFF) |
+                   PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
+
+/* Map memory BAR n into the MMIO window and return its address, or NULL if
+ * it is not a usable memory BAR.  Registers need 'wc' false; write-combining
+ * suits only memory without side effects, like a frame buffer. */
+void *pci_map_bar(struct pci_func *f, int n, bool wc)
+{
+    assert(n >= 0 && n < PCI_NBARS);
+
+    if (!f->reg_size[n] || (f->reg_flags[n] & PCI_BAR_IO))
+        return NULL;
+    if (!f->reg_va[n])
+        f->reg_va[n] = wc ? mmio_map_region_wc(f->reg_base[n], f->reg_size[n])
+            : mmio_map_region(f->reg_base[n], f->reg_size[n]);
+    return f->reg_va[n];
+}
+
+/* Return the offset of the first capability with ID 'id' that comes after
+ * offset 'after' (0 to start from the beginning), or 0 if there is none. */
+uint8_t pci_find_cap(struct pci_func *f, uint8_t id, uint8_t after)
+{
+    uint32_t hdr;
+    uint8_t off;
+    int limit = 48;             /* guards against a looping list */
+
+    if (!(pci_conf_read(f, PCI_COMMAND_REG) & PCI_STS_CAPS))
+        return 0;
+    off = after ? (pci_conf_read(f, after) >> 8) & 0xFC
+        : pci_conf_read(f, PCI_CAP_PTR_REG) & 0xFC;
+    for (; off && limit > 0; limit--) {
+        hdr = pci_conf_read(f, off);
+        if ((hdr & 0xFF) == id)
+            return off;
+        off = (hdr >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+/* Make the function signal interrupts as a single MSI message, 'vector' at
+ * the local APIC 'apic_id', instead of through its INTx# pin.  Returns
+ * -E_NOT_FOUND if it has no MSI capability. */
+int pci_msi_enable(struct pci_func *f, uint8_t vector, uint8_t apic_id)
+{
+    uint32_t cap = f->msi_cap, ctl;
+
+    if (!cap)
+        return -E_NOT_FOUND;
+
+    ctl = pci_conf_read(f, cap) >> 16;
+    pci_conf_write(f, cap + 4, MSI_ADDR | apic_id << 12);
+    if (ctl & MSI_CTL_64BIT) {
+        pci_conf_write(f, cap + 8, 0);
+        pci_conf_write(f, cap + 12, vector);
+    } else
+        pci_conf_write(f, cap + 8, vector);
+
+    ctl = (ctl & ~MSI_CTL_MME) | MSI_CTL_ENABLE;
+    pci_conf_write(f, cap, (pci_conf_read(f, cap) & 0xFFFF) | ctl << 16);
+    pci_conf_write(f, PCI_COMMAND_REG,
+                   (pci_conf_read(f, PCI_COMMAND_REG) & 0xFFFF) |
+                   PCI_CMD_INTX_OFF);
+    return 0;
+}
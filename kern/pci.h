@@ -0,0 +1,88 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PCI_H
+#define JOS_KERN_PCI_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* Configuration space registers */
+#define PCI_ID_REG          0x00    /* Vendor (low) and device (high) ID */
+#define PCI_COMMAND_REG     0x04    /* Command (low) and status (high) */
+#define   PCI_CMD_IO        0x0001  /*   Respond to I/O space accesses */
+#define   PCI_CMD_MEM       0x0002  /*   Respond to memory space accesses */
+#define   PCI_CMD_MASTER    0x0004  /*   Bus mastering (DMA) */
+#define   PCI_CMD_INTX_OFF  0x0400  /*   Do not assert INTx# */
+#define   PCI_STS_CAPS      0x00100000 /* Capability list present */
+#define PCI_CLASS_REG       0x08    /* Revision, prog IF, subclass, class */
+#define PCI_BHLC_REG        0x0C    /* Header type in bits 16-23 */
+#define   PCI_HDR_TYPE(r)   (((r) >> 16) & 0x7F)
+#define   PCI_HDR_MULTIFN   0x800000 /*  Device has several functions */
+#define PCI_BAR_REG(n)      (0x10 + 4 * (n))
+#define   PCI_BAR_IO        0x1     /*   I/O space BAR */
+#define   PCI_BAR_MEM64     0x4     /*   64-bit memory BAR */
+#define   PCI_BAR_PREFETCH  0x8     /*   Prefetchable memory */
+#define PCI_BRIDGE_BUS_REG  0x18    /* Bridges: primary/secondary/sub. bus */
+#define PCI_CAP_PTR_REG     0x34    /* First capability */
+#define PCI_INTR_REG        0x3C    /* Interrupt line (low byte) */
+
+/* Capability IDs */
+#define PCI_CAP_MSI         0x05
+#define PCI_CAP_VENDOR      0x09
+#define PCI_CAP_MSIX        0x11
+
+#define PCI_VENDOR(id)      ((id) & 0xFFFF)
+#define PCI_PRODUCT(id)     ((id) >> 16)
+#define PCI_CLASS(c)        ((c) >> 24)
+#define PCI_SUBCLASS(c)     (((c) >> 16) & 0xFF)
+#define PCI_PROGIF(c)       (((c) >> 8) & 0xFF)
+
+#define PCI_CLASS_STORAGE   0x01
+#define   PCI_SUBCLASS_SATA 0x06
+#define PCI_CLASS_BRIDGE    0x06
+#define   PCI_SUBCLASS_PCI  0x04
+
+#define PCI_NBARS           6
+
+/* A PCI function, identified by its geographical address. */
+struct pci_func {
+    uint32_t bus;
+    uint32_t dev;
+    uint32_t func;
+
+    uint32_t dev_id;            /* vendor | product << 16 */
+    uint32_t dev_class;         /* as in PCI_CLASS_REG */
+
+    /* Base address registers, sized by pci_init().  A 64-bit BAR takes two
+     * registers; its second one, and BARs mapped above 4GB, have size 0. */
+    uint32_t reg_base[PCI_NBARS];
+    uint32_t reg_size[PCI_NBARS];
+    uint8_t reg_flags[PCI_NBARS];   /* PCI_BAR_IO, _MEM64, _PREFETCH */
+    void *reg_va[PCI_NBARS];    /* set by pci_map_bar() */
+
+    uint8_t irq_line;
+    uint8_t msi_cap;            /* offset of the MSI capability, or 0 */
+};
+
+/* A driver attaches to the functions whose keys match: (class, subclass)
+ * in pci_attach_class, (vendor, product) in pci_attach_vendor.  attachfn
+ * returns > 0 if it took the function, 0 if not, < 0 on error. */
+struct pci_driver {
+    uint32_t key1, key2;
+    int (*attachfn)(struct pci_func *f);
+};
+
+void pci_init(void);
+struct pci_func *pci_get(int i);
+void pci_print_func(struct pci_func *f);
+
+uint32_t pci_conf_read(struct pci_func *f, uint32_t off);
+void pci_conf_write(struct pci_func *f, uint32_t off, uint32_t v);
+void pci_func_enable(struct pci_func *f);
+void *pci_map_bar(struct pci_func *f, int n, bool wc);
+uint8_t pci_find_cap(struct pci_func *f, uint8_t id, uint8_t after);
+int pci_msi_enable(struct pci_func *f, uint8_t vector, uint8_t apic_id);
+
+#endif /* !JOS_KERN_PCI_H */
@@ -8,6 +8,7 @@
 
 #include <kern/pmap.h>
 #include <kern/kclock.h>
+#include <kern/multiboot.h>
 
 /* These variables are set by i386_detect_memory() */
 size_t npages;                  /* Amount of physical memory (in pages) */
@@ -54,8 +55,32 @@ static void i386_detect_memory(void)
  * Set up memory mappings above UTOP.
  ***************************************************************/
 
-static void check_page_free_list(bool only_low_memory);
-static void check_page_alloc(void);
+__cold static void check_page_free_list(bool only_low_memory);
+__cold static void check_page_alloc(void);
+
+#define CPUID_PSE       (1 << 3)
+
+/* Extend entry_pgdir's mapping at KERNBASE, normally [0, 4MB), to cover
+ * physical addresses [0, top) with 4MB pages. */
+static void boot_map_extend(physaddr_t top)
+{
+    extern pde_t entry_pgdir[];
+    uint32_t edx;
+    physaddr_t pa;
+
+    if (top <= PTSIZE)
+        return;
+    if (top > -KERNBASE)
+        panic("boot_map_extend: %08x is past the direct map", top);
+    cpuid(1, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_PSE))
+        panic("boot_map_extend: no 4MB pages to map %08x", top);
+
+    lcr4(rcr4() | CR4_PSE);
+    for (pa = PTSIZE; pa < top; pa += PTSIZE)
+        entry_pgdir[PDX(KERNBASE + pa)] = pa | PTE_PS | PTE_W | PTE_P;
+    lcr3(rcr3());
+}
 
 /* This simple physical memory allocator is used only while JOS is setting up
  * its virtual memory system.  page_alloc() is the real allocator.
@@ -81,14 +106,25 @@ static void *boot_alloc(uint32_t n)
     if (!nextfree) {
         extern char end[];
         nextfree = ROUNDUP((char *) end, PGSIZE);
+
+        /* Multiboot modules follow the kernel: start past them, so they
+         * stay reserved like the kernel itself.  entry_pgdir may need to
+         * grow to reach that far, plus room for the allocations. */
+        if (multiboot_mods_end()) {
+            nextfree = MAX(nextfree, (char *) KERNBASE + multiboot_mods_end());
+            boot_map_extend(ROUNDUP(PADDR(nextfree), PTSIZE) + PTSIZE);
+        }
     }
 
     /* Allocate a chunk large enough to hold 'n' bytes, then update nextfree.
-     * Make sure nextfree is kept aligned to a multiple of PGSIZE.
-     *
-     * LAB 1: Your code here.
-     */
-    return NULL;
+     * Make sure nextfree is kept aligned to a multiple of PGSIZE. */
+    result = nextfree;
+    if (n > 0) {
+        if (n > (char *) KERNBASE + npages * PGSIZE - nextfree)
+            panic("boot_alloc: out of memory allocating %u bytes", n);
+        nextfree = ROUNDUP(nextfree + n, PGSIZE);
+    }
+    return result;
 }
 
 /*
@@ -109,16 +145,20 @@ void mem_init(void)
     /* Find out how much memory the machine has (npages & npages_basemem). */
     i386_detect_memory();
 
-    /* Remove this line when you're ready to test this function. */
-    panic("mem_init: This function is not finished\n");
+    /* Until lab 2 builds kern_pgdir, the kernel runs on entry_pgdir: have
+     * it map all of physical memory at KERNBASE, so that page2kva() works
+     * for every page page_alloc() hands out. */
+    boot_map_extend(ROUNDUP(npages * PGSIZE, PTSIZE));
 
     /*********************************************************************
      * Allocate an array of npages 'struct page_info's and store it in 'pages'.
      * The kernel uses this array to keep track of physical pages: for each
      * physical page, there is a corresponding struct page_info in this array.
-     * 'npages' is the number of physical pages in memory.  Your code goes here.
+     * 'npages' is the number of physical pages in memory.
      */
-
+    n = npages * sizeof(struct page_info);
+    pages = boot_alloc(n);
+    memset(pages, 0, n);
 
     /*********************************************************************
      * Now that we've allocated the initial kernel data structures, we set
@@ -131,7 +171,29 @@ void mem_init(void)
     check_page_free_list(1);
     check_page_alloc();
 
-    /* ... lab 2 will set up page tables here ... */
+    /* ... lab 2 will set up page tables here ...
+     * Every page directory must keep the recursive UVPT entry that
+     * entry_pgdir installs:
+     *    pgdir[PDX(UVPT)] = PADDR(pgdir) | PTE_U | PTE_P;
+     * and the entries for the MMIO window and the vmalloc region, whose
+     * page tables mmio_map_region() and vmalloc() fill in:
+     *    pgdir_copy_static_tables(pgdir); */
+}
+
+/*
+ * Copy into 'pgdir' the entry_pgdir entries for the static page tables of
+ * entrypgdir.c: the MMIO window's and the vmalloc region's.  Those regions
+ * are mapped by filling in these page tables only, so a page directory
+ * without the entries silently misses every mapping made in them.
+ */
+void pgdir_copy_static_tables(pde_t *pgdir)
+{
+    extern pde_t entry_pgdir[];
+    uintptr_t va;
+
+    pgdir[PDX(MMIOBASE)] = entry_pgdir[PDX(MMIOBASE)];
+    for (va = VMALLOCBASE; va < VMALLOCLIM; va += PTSIZE)
+        pgdir[PDX(va)] = entry_pgdir[PDX(va)];
 }
 
 /***************************************************************
@@ -149,54 +211,97 @@ void mem_init(void)
 void page_init(void)
 {
     /*
-     * The example code here marks all physical pages as free.
-     * However this is not truly the case.  What memory is free?
-     *  1) Mark physical page 0 as in use.
+     * Which physical memory is free?
+     *  1) Physical page 0 is in use.
      *     This way we preserve the real-mode IDT and BIOS structures in case we
      *     ever need them.  (Currently we don't, but...)
      *  2) The rest of base memory, [PGSIZE, npages_basemem * PGSIZE) is free.
      *  3) Then comes the IO hole [IOPHYSMEM, EXTPHYSMEM), which must never be
      *     allocated.
-     *  4) Then extended memory [EXTPHYSMEM, ...).
-     *     Some of it is in use, some is free. Where is the kernel in physical
-     *     memory?  Which pages are already in use for page tables and other
-     *     data structures?
+     *  4) Then extended memory [EXTPHYSMEM, ...).  The kernel, the Multiboot
+     *     modules and everything boot_alloc handed out come first and are in
+     *     use; the rest, from boot_alloc(0) on, is free.
      *
-     * Change the code to reflect this.
      * NB: DO NOT actually touch the physical memory corresponding to free
      *     pages! */
-    size_t i;
+    size_t i, first_free = PGNUM(PADDR(boot_alloc(0)));
+
     for (i = 0; i < npages; i++) {
         pages[i].pp_ref = 0;
+        pages[i].pp_flags = 0;
+        if (i == 0 || (i >= PGNUM(IOPHYSMEM) && i < first_free)) {
+            pages[i].pp_link = NULL;
+            continue;
+        }
         pages[i].pp_link = page_free_list;
         page_free_list = &pages[i];
     }
 }
 
+/* Take the 1024 pages of a 4MB-aligned, entirely free chunk of physical
+ * memory off the free list, and return the first, or NULL if no chunk is
+ * free.  Counting each chunk's free pages first costs one pass over the
+ * free list, and a second unlinks the chunk's pages. */
+static struct page_info *page_alloc_huge(void)
+{
+    static uint16_t nfree[NPDENTRIES];
+    struct page_info *pp, **link;
+    size_t chunk, nchunks = npages / NPTENTRIES;
+
+    memset(nfree, 0, sizeof(nfree));
+    for (pp = page_free_list; pp; pp = pp->pp_link)
+        nfree[PDX(page2pa(pp))]++;
+    for (chunk = 0; chunk < nchunks; chunk++)
+        if (nfree[chunk] == NPTENTRIES)
+            break;
+    if (chunk == nchunks)
+        return NULL;
+
+    for (link = &page_free_list; (pp = *link); )
+        if (PDX(page2pa(pp)) == chunk) {
+            *link = pp->pp_link;
+            pp->pp_link = NULL;
+        } else
+            link = &pp->pp_link;
+
+    pp = &pages[chunk * NPTENTRIES];
+    pp->pp_flags |= PP_HUGE;
+    return pp;
+}
+
 /*
- * Allocates a physical page.  
+ * Allocates a physical page.
  * If (alloc_flags & ALLOC_ZERO), fills the entire
  * returned physical page with '\0' bytes.  Does NOT increment the reference
  * count of the page - the caller must do these if necessary (either explicitly
  * or via page_insert).
- * If (alloc_flags & ALLOC_PREMAPPED), returns a physical page from the 
- * initial pool of mapped pages.
- * 
- * Be sure to set the pp_link field of the allocated page to NULL so
- * page_free can check for double-free bugs.
+ * If (alloc_flags & ALLOC_PREMAPPED), returns a physical page from the
+ * initial pool of mapped pages.  mem_init() maps all of physical memory,
+ * so every page qualifies.
+ *
+ * The pp_link field of the allocated page is NULL, so page_free can check
+ * for double-free bugs.
  *
  * Returns NULL if out of free memory.
  *
- * Hint: use page2kva and memset
- * 
  * 4MB huge pages:
- * Come back later to extend this function to support 4MB huge page allocation.
- * If (alloc_flags & ALLOC_HUGE), returns a huge physical page of 4MB size.
+ * If (alloc_flags & ALLOC_HUGE), returns the first of 1024 physically
+ * contiguous pages, 4MB-aligned, which page_free() frees together.
  */
 struct page_info *page_alloc(int alloc_flags)
 {
-    /* Fill this function in */
-    return 0;
+    struct page_info *pp;
+
+    if (alloc_flags & ALLOC_HUGE)
+        pp = page_alloc_huge();
+    else if ((pp = page_free_list)) {
+        page_free_list = pp->pp_link;
+        pp->pp_link = NULL;
+    }
+    if (pp && (alloc_flags & ALLOC_ZERO))
+        memset(page2kva(pp), 0,
+               (alloc_flags & ALLOC_HUGE) ? PTSIZE : PGSIZE);
+    return pp;
 }
 
 /*
@@ -205,9 +310,22 @@ struct page_info *page_alloc(int alloc_flags)
  */
 void page_free(struct page_info *pp)
 {
-    /* Fill this function in
-     * Hint: You may want to panic if pp->pp_ref is nonzero or
-     * pp->pp_link is not NULL. */
+    size_t i, n = 1;
+
+    if (pp->pp_ref)
+        panic("page_free: page %08x still has %u references",
+              page2pa(pp), pp->pp_ref);
+    if (pp->pp_link)
+        panic("page_free: page %08x is already free", page2pa(pp));
+
+    if (pp->pp_flags & PP_HUGE) {
+        pp->pp_flags &= ~PP_HUGE;
+        n = NPTENTRIES;
+    }
+    for (i = 0; i < n; i++) {
+        pp[i].pp_link = page_free_list;
+        page_free_list = &pp[i];
+    }
 }
 
 /*
@@ -220,6 +338,92 @@ void page_decref(struct page_info* pp)
         page_free(pp);
 }
 
+/*
+ * Reserve size bytes in the MMIO region and map [pa,pa+size) at this
+ * location with the caching attributes 'perm'.  Return the base of the
+ * reserved region.  size does *not* have to be multiple of PGSIZE; pa need
+ * not be page-aligned either.
+ *
+ * The MMIO window has a page table of its own (mmio_pgtable, installed by
+ * entrypgdir.c) that every page directory shares through
+ * pgdir_copy_static_tables(), so the mapping becomes visible everywhere at
+ * once.  Regions are never unmapped.
+ */
+static void *mmio_map(physaddr_t pa, size_t size, int perm)
+{
+    extern pte_t mmio_pgtable[];
+    static uintptr_t base = MMIOBASE;
+    uintptr_t va;
+    size_t off = PGOFF(pa);
+
+    size = ROUNDUP(size + off, PGSIZE);
+    pa = ROUNDDOWN(pa, PGSIZE);
+    if (size > MMIOLIM - base)
+        panic("mmio_map_region: out of MMIO space mapping %08x+%x",
+              pa, size);
+
+    for (va = base; va < base + size; va += PGSIZE, pa += PGSIZE) {
+        mmio_pgtable[PTX(va)] = pa | perm | PTE_W | PTE_P;
+        invlpg((void *) va);
+    }
+
+    va = base;
+    base += size;
+    return (void *) (va + off);
+}
+
+/* Map device registers: uncached, so every access reaches the device. */
+void *mmio_map_region(physaddr_t pa, size_t size)
+{
+    return mmio_map(pa, size, PTE_PCD | PTE_PWT);
+}
+
+#define MSR_IA32_PAT    0x277
+#define PAT_WC          0x01    /* write-combining memory type */
+#define CPUID_PAT       (1 << 16)
+
+/*
+ * Change the PAT the way the SDM asks for a change of memory types: with
+ * the caches off, and with no cached line or TLB entry from before the
+ * change left to disagree with it.
+ */
+static void pat_write(uint64_t pat)
+{
+    uint32_t cr0 = rcr0();
+
+    lcr0((cr0 | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    tlbflush();
+    wrmsr(MSR_IA32_PAT, pat);
+    wbinvd();
+    tlbflush();
+    lcr0(cr0);
+}
+
+/*
+ * Map device memory that tolerates combined and reordered writes, such as a
+ * frame buffer or a prefetchable BAR, write-combining.  No page uses PAT
+ * entry 4 (PTE_PAT alone), so it is reprogrammed from write-back to WC on
+ * first use.  Without PAT this falls back to an uncached mapping.
+ */
+void *mmio_map_region_wc(physaddr_t pa, size_t size)
+{
+    static int pat_wc = -1;
+    uint32_t edx;
+    uint64_t pat;
+
+    if (pat_wc < 0) {
+        cpuid(1, NULL, NULL, NULL, &edx);
+        pat_wc = (edx & CPUID_PAT) != 0;
+        if (pat_wc) {
+            pat = rdmsr(MSR_IA32_PAT);
+            pat = (pat & ~(0xFFULL << 32)) | ((uint64_t) PAT_WC << 32);
+            pat_write(pat);
+        }
+    }
+    return mmio_map(pa, size, pat_wc ? PTE_PAT : PTE_PCD | PTE_PWT);
+}
+
 
 /***************************************************************
  * Checking functions.
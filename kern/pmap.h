@@ -49,12 +49,16 @@ enum {
 };
 
 void mem_init(void);
+void pgdir_copy_static_tables(pde_t *pgdir);
 
 void page_init(void);
 struct page_info *page_alloc(int alloc_flags);
 void page_free(struct page_info *pp);
 void page_decref(struct page_info *pp);
 
+void *mmio_map_region(physaddr_t pa, size_t size);
+void *mmio_map_region_wc(physaddr_t pa, size_t size);
+
 static inline physaddr_t page2pa(struct page_info *pp)
 {
     return (pp - pages) << PGSHIFT;
@@ -7,6 +7,8 @@
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
 
+#include <kern/console.h>
+
 
 static void putch(int ch, int *cnt)
 {
@@ -19,6 +21,7 @@ int vcprintf(const char *fmt, va_list ap)
     int cnt = 0;
 
     vprintfmt((void*)putch, &cnt, fmt, ap);
+    cons_flush();
     return cnt;
 }
 
@@ -0,0 +1,86 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Ramdisks over the Multiboot modules: 'qemu -kernel obj/kern/kernel
+ * -initrd data.img' shows data.img as block device rd0, with no I/O to
+ * load it.  The module's memory is the disk, so writes change it in place
+ * and are lost at reboot.
+ *
+ * The buffer cache maps ramdisk blocks instead of copying them (see
+ * dev->mem); requests through the block layer are plain memory copies.
+ */
+
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/ramdisk.h>
+#include <kern/multiboot.h>
+#include <kern/blk.h>
+#include <kern/pmap.h>
+
+struct ramdisk {
+    struct blk_dev dev;
+    struct blk_req *done;       /* transfer to report on the next poll */
+};
+
+static struct ramdisk ramdisks[MB_MAXMODS];
+
+static int rd_start(struct blk_dev *dev, struct blk_req *req)
+{
+    struct ramdisk *rd = dev->priv;
+    struct blk_req *r;
+    char *p = (char *) dev->mem + req->rq_sector * SECTSIZE;
+
+    for (r = req; r; r = r->rq_next) {
+        if (r->rq_write)
+            memmove(p, r->rq_buf, r->rq_nsect * SECTSIZE);
+        else
+            memmove(r->rq_buf, p, r->rq_nsect * SECTSIZE);
+        p += r->rq_nsect * SECTSIZE;
+    }
+    rd->done = req;
+    return 0;
+}
+
+static void rd_poll(struct blk_dev *dev)
+{
+    struct ramdisk *rd = dev->priv;
+    struct blk_req *req = rd->done;
+
+    if (req) {
+        rd->done = NULL;
+        blk_complete(dev, req, 0);
+    }
+}
+
+static const struct blk_ops rd_ops = {
+    .start = rd_start,
+    .poll = rd_poll,
+};
+
+void ramdisk_init(void)
+{
+    static const char *names[] = {
+        "rd0", "rd1", "rd2", "rd3", "rd4", "rd5", "rd6", "rd7"
+    };
+    const struct mb_module *m;
+    struct ramdisk *rd;
+    int i;
+
+    static_assert(sizeof(names) / sizeof(names[0]) == MB_MAXMODS);
+
+    for (i = 0; (m = multiboot_mod(i)); i++) {
+        rd = &ramdisks[i];
+        rd->dev.name = names[i];
+        /* The rest of the module's last page is reserved too. */
+        rd->dev.nsectors = ROUNDUP(m->end - m->start, SECTSIZE) / SECTSIZE;
+        rd->dev.max_nsect = 8192;
+        rd->dev.depth = 1;
+        rd->dev.ops = &rd_ops;
+        rd->dev.priv = rd;
+        rd->dev.mem = KADDR(m->start);
+        blk_register(&rd->dev);
+        cprintf("%s: module '%s', %u KB\n", rd->dev.name, m->name,
+                (m->end - m->start) / 1024);
+    }
+}
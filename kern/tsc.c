@@ -0,0 +1,53 @@
+/* See COPYRIGHT for copyright information. */
+
+/* Calibration of the time stamp counter against the 8254 PIT, so benchmarks
+ * can turn read_tsc() deltas into wall-clock time. */
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+
+#include <kern/tsc.h>
+
+#define PIT_HZ          1193182     /* 8254 input clock */
+#define PIT_CH2         0x42        /* Channel 2 data port */
+#define PIT_MODE        0x43        /* Mode/command register */
+#define PIT_GATE        0x61        /* Channel 2 gate and output (port B) */
+#define   PIT_GATE_EN   0x01        /*   Gate input of channel 2 */
+#define   PIT_SPKR_EN   0x02        /*   Speaker data enable */
+#define   PIT_OUT2      0x20        /*   Channel 2 output */
+
+#define CALIBRATE_MS    10
+
+uint64_t tsc_freq;
+
+/* Count TSC ticks while PIT channel 2 counts down CALIBRATE_MS milliseconds
+ * in mode 0 ("interrupt on terminal count"), then scale up to one second. */
+void tsc_init(void)
+{
+    uint32_t latch = PIT_HZ / (1000 / CALIBRATE_MS);
+    uint64_t t0, t1;
+
+    /* Gate channel 2 on, keep the speaker off. */
+    outb(PIT_GATE, (inb(PIT_GATE) & ~PIT_SPKR_EN) | PIT_GATE_EN);
+
+    /* Channel 2, lobyte/hibyte access, mode 0, binary. */
+    outb(PIT_MODE, 0xB0);
+    outb(PIT_CH2, latch & 0xFF);
+    outb(PIT_CH2, latch >> 8);
+
+    t0 = read_tsc();
+    while (!(inb(PIT_GATE) & PIT_OUT2))
+        /* do nothing */;
+    t1 = read_tsc();
+
+    tsc_freq = (t1 - t0) * PIT_HZ / latch;
+    cprintf("TSC: %llu MHz\n", tsc_freq / 1000000);
+}
+
+/* Convert a TSC delta into microseconds. */
+uint64_t tsc_to_usec(uint64_t cycles)
+{
+    if (!tsc_freq)
+        return 0;
+    return cycles * 1000000 / tsc_freq;
+}
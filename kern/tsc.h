@@ -0,0 +1,17 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TSC_H
+#define JOS_KERN_TSC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* Time stamp counter frequency in Hz, measured by tsc_init(). */
+extern uint64_t tsc_freq;
+
+void tsc_init(void);
+uint64_t tsc_to_usec(uint64_t cycles);
+
+#endif /* !JOS_KERN_TSC_H */
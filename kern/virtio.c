@@ -0,0 +1,361 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Virtio over the modern (1.0) PCI transport, and split virtqueues.
+ *
+ * The transport's registers sit in memory BARs that vendor-specific PCI
+ * capabilities point at: the common configuration (features, status, queue
+ * setup), the queue notify registers, the ISR and the device-specific
+ * configuration.  Each virtqueue lives in one page: the descriptor table,
+ * the available ring the driver fills and the used ring the device fills.
+ *
+ * The kernel polls for completions, so it asks the device not to interrupt
+ * it.  With VIRTIO_F_EVENT_IDX the device in turn tells us which available
+ * index it wants to hear about, which lets virtq_kick() skip notifications
+ * (each one a VM exit) while the device is still working through the ring.
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/virtio.h>
+#include <kern/pmap.h>
+
+/* Vendor-specific capability: where a configuration structure lives */
+#define VIRTIO_CAP_CFG_TYPE(hdr)    ((hdr) >> 24)
+#define   VIRTIO_PCI_CAP_COMMON     1
+#define   VIRTIO_PCI_CAP_NOTIFY     2
+#define   VIRTIO_PCI_CAP_ISR        3
+#define   VIRTIO_PCI_CAP_DEVICE     4
+#define VIRTIO_CAP_BAR              4   /* offsets within the capability */
+#define VIRTIO_CAP_OFFSET           8
+#define VIRTIO_CAP_LENGTH           12
+#define VIRTIO_CAP_NOTIFY_MULT      16
+
+#define VIRTIO_MSI_NO_VECTOR        0xFFFF
+
+/* Common configuration.  The 64-bit queue addresses are written as two
+ * halves, which the specification allows. */
+struct virtio_pci_common_cfg {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint32_t queue_desc_lo;
+    uint32_t queue_desc_hi;
+    uint32_t queue_driver_lo;
+    uint32_t queue_driver_hi;
+    uint32_t queue_device_lo;
+    uint32_t queue_device_hi;
+};
+
+/* Order our ring updates against the device's, in both directions. */
+static inline void virtio_mb(void)
+{
+    __asm __volatile("lock; addl $0,0(%%esp)" : : : "memory", "cc");
+}
+
+/* Map the structure a virtio capability describes. */
+static volatile uint8_t *virtio_map_cap(struct pci_func *f, uint8_t cap)
+{
+    uint32_t bar = pci_conf_read(f, cap + VIRTIO_CAP_BAR) & 0xFF;
+    uint32_t off = pci_conf_read(f, cap + VIRTIO_CAP_OFFSET);
+    uint32_t len = pci_conf_read(f, cap + VIRTIO_CAP_LENGTH);
+    uint8_t *base;
+
+    if (bar >= PCI_NBARS || off + len > f->reg_size[bar] ||
+        !(base = pci_map_bar(f, bar, false)))
+        return NULL;
+    return base + off;
+}
+
+/* Find the device's configuration structures, reset it and announce a
+ * driver.  Returns -E_NOT_FOUND for a device without the modern
+ * interface. */
+int virtio_pci_init(struct virtio_dev *vd, struct pci_func *f)
+{
+    uint8_t cap = 0;
+    uint32_t type;
+
+    memset(vd, 0, sizeof(*vd));
+    vd->pcif = f;
+
+    /* The first capability of each type is the preferred one. */
+    while ((cap = pci_find_cap(f, PCI_CAP_VENDOR, cap))) {
+        type = VIRTIO_CAP_CFG_TYPE(pci_conf_read(f, cap));
+        if (type == VIRTIO_PCI_CAP_COMMON && !vd->common)
+            vd->common = (volatile struct virtio_pci_common_cfg *)
+                virtio_map_cap(f, cap);
+        else if (type == VIRTIO_PCI_CAP_NOTIFY && !vd->notify_base) {
+            vd->notify_base = virtio_map_cap(f, cap);
+            vd->notify_mult = pci_conf_read(f, cap + VIRTIO_CAP_NOTIFY_MULT);
+        } else if (type == VIRTIO_PCI_CAP_ISR && !vd->isr)
+            vd->isr = virtio_map_cap(f, cap);
+        else if (type == VIRTIO_PCI_CAP_DEVICE && !vd->devcfg)
+            vd->devcfg = virtio_map_cap(f, cap);
+    }
+    if (!vd->common || !vd->notify_base)
+        return -E_NOT_FOUND;
+
+    pci_func_enable(f);
+    vd->common->device_status = 0;
+    while (vd->common->device_status != 0)
+        /* do nothing */;
+    vd->common->device_status = VIRTIO_STAT_ACK;
+    vd->common->device_status |= VIRTIO_STAT_DRIVER;
+    return 0;
+}
+
+/* Accept the features in 'wanted' that the device offers, plus
+ * VIRTIO_F_VERSION_1, which the modern interface requires. */
+int virtio_negotiate(struct virtio_dev *vd, uint64_t wanted)
+{
+    volatile struct virtio_pci_common_cfg *c = vd->common;
+    uint64_t offered;
+
+    c->device_feature_select = 0;
+    offered = c->device_feature;
+    c->device_feature_select = 1;
+    offered |= (uint64_t) c->device_feature << 32;
+    if (!(offered & VIRTIO_FEATURE(VIRTIO_F_VERSION_1)))
+        return -E_INVAL;
+
+    vd->features = offered & (wanted | VIRTIO_FEATURE(VIRTIO_F_VERSION_1));
+    c->driver_feature_select = 0;
+    c->driver_feature = vd->features;
+    c->driver_feature_select = 1;
+    c->driver_feature = vd->features >> 32;
+
+    c->device_status |= VIRTIO_STAT_FEATURES_OK;
+    if (!(c->device_status & VIRTIO_STAT_FEATURES_OK))
+        return -E_INVAL;
+    return 0;
+}
+
+/* Set up virtqueue 'index' with at most VIRTQ_MAXSIZE entries. */
+int virtq_init(struct virtio_dev *vd, struct virtq *vq, uint16_t index)
+{
+    volatile struct virtio_pci_common_cfg *c = vd->common;
+    struct page_info *pp;
+    physaddr_t pa;
+    uint16_t size, i;
+    size_t off;
+
+    c->queue_select = index;
+    if (!(size = c->queue_size))
+        return -E_NOT_FOUND;
+    size = MIN(size, VIRTQ_MAXSIZE);
+    if (!(pp = page_alloc(ALLOC_ZERO)))
+        return -E_NO_MEM;
+
+    memset(vq, 0, sizeof(*vq));
+    vq->vd = vd;
+    vq->index = index;
+    vq->size = size;
+    vq->event_idx = vd->features & VIRTIO_FEATURE(VIRTIO_F_EVENT_IDX);
+    vq->indirect = vd->features & VIRTIO_FEATURE(VIRTIO_F_INDIRECT_DESC);
+
+    /* Descriptors, then the available ring and the used ring, which needs
+     * 4-byte alignment.  Both rings end in a 16-bit event index. */
+    pa = page2pa(pp);
+    vq->desc = page2kva(pp);
+    off = size * sizeof(struct virtq_desc);
+    vq->avail = (struct virtq_avail *) ((char *) vq->desc + off);
+    off = ROUNDUP(off + sizeof(struct virtq_avail) + (size + 1) * 2, 4);
+    vq->used = (struct virtq_used *) ((char *) vq->desc + off);
+    assert(off + sizeof(struct virtq_used) +
+           size * sizeof(struct virtq_used_elem) + 2 <= PGSIZE);
+
+    for (i = 0; i < size; i++)
+        vq->desc[i].next = i + 1;
+    vq->nfree = size;
+
+    /* No interrupts, please: we poll.  With EVENT_IDX that means keeping
+     * used_event behind the entries we have consumed (see virtq_get()). */
+    if (vq->event_idx)
+        vq->avail->ring[size] = (uint16_t) -1;
+    else
+        vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+    c->queue_size = size;
+    c->queue_msix_vector = VIRTIO_MSI_NO_VECTOR;
+    c->queue_desc_lo = pa;
+    c->queue_desc_hi = 0;
+    c->queue_driver_lo = pa + ((char *) vq->avail - (char *) vq->desc);
+    c->queue_driver_hi = 0;
+    c->queue_device_lo = pa + off;
+    c->queue_device_hi = 0;
+    vq->notify = (volatile uint16_t *)
+        (vd->notify_base + c->queue_notify_off * vd->notify_mult);
+    c->queue_enable = 1;
+    return 0;
+}
+
+/* Let the device start using its queues. */
+void virtio_ready(struct virtio_dev *vd)
+{
+    vd->common->device_status |= VIRTIO_STAT_DRIVER_OK;
+}
+
+/* Give up on the device. */
+void virtio_fail(struct virtio_dev *vd)
+{
+    vd->common->device_status |= VIRTIO_STAT_FAILED;
+}
+
+/* Read a 1-, 2-, 4- or 8-byte field of the device configuration.  The
+ * device may change it meanwhile, so retry until the configuration
+ * generation is stable. */
+uint64_t virtio_cfg_read(struct virtio_dev *vd, uint32_t off, int size)
+{
+    volatile uint8_t *p = vd->devcfg + off;
+    uint64_t v;
+    uint8_t gen;
+
+    assert(vd->devcfg);
+    do {
+        gen = vd->common->config_generation;
+        switch (size) {
+        case 1:
+            v = *p;
+            break;
+        case 2:
+            v = *(volatile uint16_t *) p;
+            break;
+        case 4:
+            v = *(volatile uint32_t *) p;
+            break;
+        case 8:
+            v = *(volatile uint32_t *) p |
+                (uint64_t) *(volatile uint32_t *) (p + 4) << 32;
+            break;
+        default:
+            panic("virtio_cfg_read: bad size %d", size);
+        }
+    } while (gen != vd->common->config_generation);
+    return v;
+}
+
+/*
+ * Add a buffer made of the 'nout' device-readable segments of 'sg' followed
+ * by 'nin' device-writable ones.  If the device takes indirect descriptors
+ * and the caller provides a table 'itbl' with room for all the segments,
+ * the buffer takes one ring entry; otherwise it takes one per segment.
+ * 'cookie' is returned by virtq_get() once the device is done with it.  The
+ * device does not see the buffer before virtq_kick().  Returns -E_NO_MEM if
+ * the ring is full.
+ */
+int virtq_add(struct virtq *vq, const struct virtq_sg *sg, int nout, int nin,
+        struct virtq_desc *itbl, void *cookie)
+{
+    struct virtq_desc *tbl;
+    uint16_t head, d = 0;
+    int n = nout + nin, i;
+    bool indirect = itbl && vq->indirect && n > 1;
+
+    assert(n > 0);
+    if (vq->nfree < (indirect ? 1 : n))
+        return -E_NO_MEM;
+
+    head = vq->free_head;
+    if (indirect) {
+        tbl = itbl;
+        vq->free_head = vq->desc[head].next;
+        vq->nfree--;
+        vq->desc[head].addr = PADDR(itbl);
+        vq->desc[head].len = n * sizeof(struct virtq_desc);
+        vq->desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+    } else {
+        /* Chain through the free list's own links. */
+        tbl = vq->desc;
+        d = head;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (indirect)
+            d = i;
+        tbl[d].addr = sg[i].addr;
+        tbl[d].len = sg[i].len;
+        tbl[d].flags = (i >= nout ? VIRTQ_DESC_F_WRITE : 0) |
+            (i + 1 < n ? VIRTQ_DESC_F_NEXT : 0);
+        if (indirect)
+            tbl[d].next = i + 1;
+        else
+            d = tbl[d].next;
+    }
+    if (!indirect) {
+        vq->free_head = d;
+        vq->nfree -= n;
+    }
+
+    vq->cookie[head] = cookie;
+    vq->avail->ring[vq->avail_idx % vq->size] = head;
+    vq->avail_idx++;
+    return 0;
+}
+
+/* Publish the buffers added since the last kick, and notify the device if
+ * it asked to hear about them. */
+void virtq_kick(struct virtq *vq)
+{
+    uint16_t old = vq->kick_idx, new = vq->avail_idx, event;
+    bool notify;
+
+    if (old == new)
+        return;
+    virtio_mb();
+    vq->avail->idx = new;
+    virtio_mb();
+
+    if (vq->event_idx) {
+        /* avail_event follows the used ring. */
+        event = *(volatile uint16_t *) &vq->used->ring[vq->size];
+        notify = (uint16_t) (new - event - 1) < (uint16_t) (new - old);
+    } else
+        notify = !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+
+    vq->kick_idx = new;
+    if (notify)
+        *vq->notify = vq->index;
+}
+
+/* Return the cookie of the next buffer the device has finished with, and
+ * the number of bytes it wrote in *lenp, or NULL if there is none. */
+void *virtq_get(struct virtq *vq, uint32_t *lenp)
+{
+    uint16_t idx, head, d;
+    void *cookie;
+
+    if (vq->last_used == vq->used->idx)
+        return NULL;
+    virtio_mb();
+
+    idx = vq->last_used++ % vq->size;
+    head = vq->used->ring[idx].id;
+    if (lenp)
+        *lenp = vq->used->ring[idx].len;
+    cookie = vq->cookie[head];
+    vq->cookie[head] = NULL;
+
+    /* Return the chain to the free list. */
+    for (d = head, vq->nfree++; vq->desc[d].flags & VIRTQ_DESC_F_NEXT;
+         vq->nfree++)
+        d = vq->desc[d].next;
+    vq->desc[d].next = vq->free_head;
+    vq->free_head = head;
+
+    if (vq->event_idx)
+        vq->avail->ring[vq->size] = vq->last_used - 1;
+    return cookie;
+}
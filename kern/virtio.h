@@ -0,0 +1,121 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_VIRTIO_H
+#define JOS_KERN_VIRTIO_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#include <kern/pci.h>
+
+/* PCI IDs: transitional devices have product IDs from 0x1000, devices
+ * without the legacy interface 0x1040 plus the virtio device type. */
+#define VIRTIO_PCI_VENDOR       0x1AF4
+#define VIRTIO_PCI_BLK_TRANS    0x1001
+#define VIRTIO_PCI_CONSOLE_TRANS 0x1003
+#define VIRTIO_PCI_MODERN(type) (0x1040 + (type))
+#define VIRTIO_ID_BLOCK         2
+#define VIRTIO_ID_CONSOLE       3
+
+/* Device status */
+#define VIRTIO_STAT_ACK         0x01
+#define VIRTIO_STAT_DRIVER      0x02
+#define VIRTIO_STAT_DRIVER_OK   0x04
+#define VIRTIO_STAT_FEATURES_OK 0x08
+#define VIRTIO_STAT_FAILED      0x80
+
+/* Device-independent feature bits */
+#define VIRTIO_F_INDIRECT_DESC  28
+#define VIRTIO_F_EVENT_IDX      29
+#define VIRTIO_F_VERSION_1      32
+
+#define VIRTIO_FEATURE(bit)     (1ULL << (bit))
+
+/* Split virtqueue layout, shared with the device */
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+#define VIRTQ_DESC_F_NEXT       1
+#define VIRTQ_DESC_F_WRITE      2   /* device writes the buffer */
+#define VIRTQ_DESC_F_INDIRECT   4   /* buffer is a table of descriptors */
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];            /* then used_event, with EVENT_IDX */
+};
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1
+
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];  /* then avail_event, with EVENT_IDX */
+};
+
+#define VIRTQ_USED_F_NO_NOTIFY  1
+
+#define VIRTQ_MAXSIZE   128     /* largest queue we set up: it fits a page */
+
+/* One buffer of a request, in guest physical memory. */
+struct virtq_sg {
+    physaddr_t addr;
+    uint32_t len;
+};
+
+struct virtio_dev;
+
+struct virtq {
+    struct virtio_dev *vd;
+    uint16_t index;
+    uint16_t size;
+    struct virtq_desc *desc;
+    struct virtq_avail *avail;
+    volatile struct virtq_used *used;
+    volatile uint16_t *notify;  /* queue notify register */
+
+    uint16_t free_head;         /* chain of free descriptors */
+    uint16_t nfree;
+    uint16_t avail_idx;         /* next avail index to publish */
+    uint16_t kick_idx;          /* avail->idx at the last notification */
+    uint16_t last_used;         /* next used entry to consume */
+    bool event_idx;
+    bool indirect;
+    void *cookie[VIRTQ_MAXSIZE];    /* caller's token per chain head */
+};
+
+/* A virtio device found through the PCI transport. */
+struct virtio_dev {
+    struct pci_func *pcif;
+    volatile struct virtio_pci_common_cfg *common;
+    volatile uint8_t *notify_base;
+    uint32_t notify_mult;
+    volatile uint8_t *isr;
+    volatile uint8_t *devcfg;   /* device-specific configuration */
+    uint64_t features;          /* negotiated */
+};
+
+int virtio_pci_init(struct virtio_dev *vd, struct pci_func *f);
+int virtio_negotiate(struct virtio_dev *vd, uint64_t wanted);
+int virtq_init(struct virtio_dev *vd, struct virtq *vq, uint16_t index);
+void virtio_ready(struct virtio_dev *vd);
+void virtio_fail(struct virtio_dev *vd);
+uint64_t virtio_cfg_read(struct virtio_dev *vd, uint32_t off, int size);
+
+int virtq_add(struct virtq *vq, const struct virtq_sg *sg, int nout, int nin,
+        struct virtq_desc *itbl, void *cookie);
+void virtq_kick(struct virtq *vq);
+void *virtq_get(struct virtq *vq, uint32_t *lenp);
+
+#endif /* !JOS_KERN_VIRTIO_H */
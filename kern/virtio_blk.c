@@ -0,0 +1,236 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * virtio-blk driver: the paravirtual disk of QEMU and other hypervisors
+ * (-device virtio-blk-pci).
+ *
+ * A transfer is one virtqueue buffer: a request header, one segment per
+ * merged block request and a status byte the device fills in.  With
+ * indirect descriptors the segments live in a per-slot table and the
+ * transfer takes a single ring entry, so the ring never limits the queue
+ * depth.  All transfers go through request queue 0; the device may offer
+ * more (VIRTIO_BLK_F_MQ) to spread them over CPUs, but the kernel runs on
+ * one.
+ */
+
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/virtio_blk.h>
+#include <kern/virtio.h>
+#include <kern/blk.h>
+#include <kern/pmap.h>
+
+/* Feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX   1   /* size_max: largest segment */
+#define VIRTIO_BLK_F_SEG_MAX    2   /* seg_max: most segments per request */
+#define VIRTIO_BLK_F_RO         5   /* read-only disk */
+
+/* Device configuration */
+#define VIRTIO_BLK_CFG_CAPACITY 0   /* 64-bit, in 512-byte sectors */
+#define VIRTIO_BLK_CFG_SIZE_MAX 8
+#define VIRTIO_BLK_CFG_SEG_MAX  12
+
+/* Request types and status */
+#define VIRTIO_BLK_T_IN         0
+#define VIRTIO_BLK_T_OUT        1
+#define VIRTIO_BLK_S_OK         0
+
+struct virtio_blk_outhdr {
+    uint32_t type;
+    uint32_t ioprio;
+    uint64_t sector;
+};
+
+#define VBLK_MAXDISKS   4
+#define VBLK_NSLOT      32              /* transfers in flight */
+#define VBLK_NSEG       62              /* data segments per transfer */
+#define VBLK_ITBL       (VBLK_NSEG + 2) /* plus header and status */
+#define VBLK_ITBL_PER_PAGE  (PGSIZE / (VBLK_ITBL * sizeof(struct virtq_desc)))
+
+/* A transfer's header and status, which the device reads and writes. */
+struct vblk_slot {
+    struct virtio_blk_outhdr hdr;
+    uint8_t status;
+    struct blk_req *req;
+};
+
+struct vblk_disk {
+    struct blk_dev dev;
+    struct virtio_dev vd;
+    struct virtq vq;
+    bool ro;
+    uint32_t busy;              /* slots holding a transfer */
+    struct vblk_slot *slots;
+    struct virtq_desc *itbl[VBLK_NSLOT];
+};
+
+static struct vblk_disk vblk_disks[VBLK_MAXDISKS];
+static int vblk_ndisks;
+
+static int vblk_start(struct blk_dev *dev, struct blk_req *req)
+{
+    struct vblk_disk *disk = dev->priv;
+    struct virtq_sg sg[VBLK_ITBL];
+    struct vblk_slot *s;
+    struct blk_req *r;
+    uint32_t slot;
+    int n = 0, nout;
+
+    if (req->rq_write && disk->ro)
+        return -E_IO;
+
+    for (slot = 0; disk->busy & (1 << slot); slot++)
+        /* do nothing */;
+    assert(slot < VBLK_NSLOT);
+    s = &disk->slots[slot];
+
+    s->hdr.type = req->rq_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    s->hdr.ioprio = 0;
+    s->hdr.sector = req->rq_sector;
+    s->status = 0xFF;
+    sg[n].addr = PADDR(&s->hdr);
+    sg[n++].len = sizeof(s->hdr);
+    for (r = req; r; r = r->rq_next) {
+        assert(n <= VBLK_NSEG);
+        sg[n].addr = PADDR(r->rq_buf);
+        sg[n++].len = r->rq_nsect * SECTSIZE;
+    }
+    sg[n].addr = PADDR(&s->status);
+    sg[n++].len = 1;
+
+    /* The device reads the header (and the data, for a write) and writes
+     * the rest. */
+    nout = req->rq_write ? n - 1 : 1;
+    if (virtq_add(&disk->vq, sg, nout, n - nout, disk->itbl[slot], s) < 0)
+        return -E_IO;
+    s->req = req;
+    disk->busy |= 1 << slot;
+    return 0;
+}
+
+static void vblk_commit(struct blk_dev *dev)
+{
+    struct vblk_disk *disk = dev->priv;
+
+    virtq_kick(&disk->vq);
+}
+
+static void vblk_poll(struct blk_dev *dev)
+{
+    struct vblk_disk *disk = dev->priv;
+    struct vblk_slot *s;
+    struct blk_req *req;
+
+    while ((s = virtq_get(&disk->vq, NULL))) {
+        req = s->req;
+        s->req = NULL;
+        disk->busy &= ~(1 << (s - disk->slots));
+        blk_complete(dev, req, s->status == VIRTIO_BLK_S_OK ? 0 : -E_IO);
+    }
+}
+
+static const struct blk_ops vblk_ops = {
+    .start = vblk_start,
+    .poll = vblk_poll,
+    .commit = vblk_commit,
+};
+
+/* Allocate the slots and indirect tables and size the queue. */
+static int vblk_setup(struct vblk_disk *disk)
+{
+    struct virtio_dev *vd = &disk->vd;
+    struct page_info *pp = NULL;
+    uint32_t segs = VBLK_NSEG, i, n;
+
+    static_assert(VBLK_NSLOT * sizeof(struct vblk_slot) <= PGSIZE);
+
+    /* Without indirect descriptors a request takes ring entries for its
+     * header, at least one segment and its status. */
+    if (!disk->vq.indirect && disk->vq.size < 3)
+        return -E_INVAL;
+
+    if (!(pp = page_alloc(ALLOC_ZERO)))
+        return -E_NO_MEM;
+    disk->slots = page2kva(pp);
+
+    if (disk->vq.indirect) {
+        for (i = 0; i < VBLK_NSLOT; i++) {
+            n = i % VBLK_ITBL_PER_PAGE;
+            if (n == 0 && !(pp = page_alloc(0)))
+                return -E_NO_MEM;
+            disk->itbl[i] = (struct virtq_desc *) page2kva(pp) + n * VBLK_ITBL;
+        }
+        disk->dev.depth = MIN(VBLK_NSLOT, disk->vq.size);
+    } else {
+        /* Every segment takes a ring entry: share them among the slots.
+         * A ring of 3 or more leaves each slot at least 3 entries, so at
+         * least one segment besides the header and status. */
+        disk->dev.depth = MAX(MIN(VBLK_NSLOT, disk->vq.size / 4), 1);
+        n = disk->vq.size / disk->dev.depth;
+        assert(n >= 3);
+        segs = MIN(segs, n - 2);
+    }
+
+    if (vd->features & VIRTIO_FEATURE(VIRTIO_BLK_F_SEG_MAX))
+        segs = MIN(segs, (uint32_t) virtio_cfg_read(vd,
+                                          VIRTIO_BLK_CFG_SEG_MAX, 4));
+    disk->dev.max_segs = MAX(segs, 1U);
+
+    disk->dev.max_nsect = 8192;
+    if (vd->features & VIRTIO_FEATURE(VIRTIO_BLK_F_SIZE_MAX))
+        disk->dev.max_nsect = MIN(disk->dev.max_nsect,
+            (uint32_t) virtio_cfg_read(vd, VIRTIO_BLK_CFG_SIZE_MAX, 4) /
+            SECTSIZE);
+    if (disk->dev.max_nsect == 0)
+        return -E_INVAL;
+    return 0;
+}
+
+/* PCI attach function for virtio block devices. */
+int virtio_blk_attach(struct pci_func *f)
+{
+    static const char *names[] = { "vblk0", "vblk1", "vblk2", "vblk3" };
+    struct vblk_disk *disk;
+    struct virtio_dev *vd;
+    int r;
+
+    if (vblk_ndisks == VBLK_MAXDISKS)
+        return -E_NO_MEM;
+    disk = &vblk_disks[vblk_ndisks];
+    vd = &disk->vd;
+
+    if ((r = virtio_pci_init(vd, f)) < 0)
+        return r;
+    if (!vd->devcfg) {
+        r = -E_NOT_FOUND;
+        goto fail;
+    }
+    if ((r = virtio_negotiate(vd,
+                    VIRTIO_FEATURE(VIRTIO_F_INDIRECT_DESC) |
+                    VIRTIO_FEATURE(VIRTIO_F_EVENT_IDX) |
+                    VIRTIO_FEATURE(VIRTIO_BLK_F_SIZE_MAX) |
+                    VIRTIO_FEATURE(VIRTIO_BLK_F_SEG_MAX) |
+                    VIRTIO_FEATURE(VIRTIO_BLK_F_RO))) < 0 ||
+        (r = virtq_init(vd, &disk->vq, 0)) < 0 ||
+        (r = vblk_setup(disk)) < 0)
+        goto fail;
+
+    disk->ro = vd->features & VIRTIO_FEATURE(VIRTIO_BLK_F_RO);
+    disk->dev.nsectors = virtio_cfg_read(vd, VIRTIO_BLK_CFG_CAPACITY, 8);
+    disk->dev.name = names[vblk_ndisks++];
+    disk->dev.ops = &vblk_ops;
+    disk->dev.priv = disk;
+    virtio_ready(vd);
+    blk_register(&disk->dev);
+    cprintf("%s: %s%s, queue depth %d, %d segments\n", disk->dev.name,
+            disk->vq.indirect ? "indirect" : "direct",
+            disk->ro ? ", read-only" : "", disk->dev.depth,
+            disk->dev.max_segs);
+    return 1;
+
+fail:
+    virtio_fail(vd);
+    return r;
+}
@@ -0,0 +1,13 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_VIRTIO_BLK_H
+#define JOS_KERN_VIRTIO_BLK_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <kern/pci.h>
+
+int virtio_blk_attach(struct pci_func *f);
+
+#endif /* !JOS_KERN_VIRTIO_BLK_H */
@@ -0,0 +1,125 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * virtio console (-device virtio-serial-pci -device virtconsole), used as
+ * an output sink for the kernel console.
+ *
+ * Output collects in page-sized buffers.  A flush hands the current buffer
+ * to the device's transmit queue with a single kick and moves on to the
+ * next buffer, so a whole cprintf() costs one VM exit instead of one per
+ * byte through the 16550.  Without VIRTIO_CONSOLE_F_MULTIPORT the device
+ * has one port, port 0, whose transmit queue is queue 1.
+ */
+
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/virtio_cons.h>
+#include <kern/virtio.h>
+#include <kern/console.h>
+#include <kern/pmap.h>
+
+#define VCONS_TXQ       1       /* port 0 transmit queue */
+#define VCONS_NBUF      8       /* output buffers, one page each */
+#define VCONS_SPIN      10000000 /* polls for a buffer before giving up */
+
+static struct {
+    struct virtio_dev vd;
+    struct virtq txq;
+    char *buf[VCONS_NBUF];
+    uint32_t busy;              /* buffers the device holds */
+    int cur;                    /* buffer being filled */
+    uint32_t len;               /* bytes in it */
+} vcons;
+
+/* Take back the buffers the device has sent. */
+static void vcons_reclaim(void)
+{
+    void *cookie;
+
+    while ((cookie = virtq_get(&vcons.txq, NULL)))
+        vcons.busy &= ~(1 << ((uintptr_t) cookie - 1));
+}
+
+static void vcons_flush(void)
+{
+    struct virtq_sg sg;
+    int spin;
+
+    if (vcons.len == 0)
+        return;
+
+    sg.addr = PADDR(vcons.buf[vcons.cur]);
+    sg.len = vcons.len;
+    if (virtq_add(&vcons.txq, &sg, 1, 0, NULL,
+                  (void *) (uintptr_t) (vcons.cur + 1)) < 0)
+        panic("vcons_flush: transmit queue full");
+    vcons.busy |= 1 << vcons.cur;
+    virtq_kick(&vcons.txq);
+
+    /* Move on to the next buffer, once the device is done with it.  A host
+     * that stops reading must not hang the kernel: fall back to the
+     * serial port. */
+    vcons.cur = (vcons.cur + 1) % VCONS_NBUF;
+    vcons.len = 0;
+    for (spin = VCONS_SPIN; vcons.busy & (1 << vcons.cur); spin--) {
+        if (spin == 0) {
+            cons_set_sink(NULL);
+            return;
+        }
+        vcons_reclaim();
+    }
+}
+
+static void vcons_putc(int c)
+{
+    vcons.buf[vcons.cur][vcons.len++] = c;
+    if (vcons.len == PGSIZE)
+        vcons_flush();
+}
+
+static const struct cons_sink vcons_sink = {
+    .name = "the virtio console",
+    .putc = vcons_putc,
+    .flush = vcons_flush,
+};
+
+/* PCI attach function for virtio consoles.  The first one becomes the
+ * console. */
+int virtio_cons_attach(struct pci_func *f)
+{
+    struct virtio_dev *vd = &vcons.vd;
+    struct page_info *pp;
+    int i, r;
+
+    if (vcons.buf[0])
+        return 0;
+
+    if ((r = virtio_pci_init(vd, f)) < 0)
+        return r;
+    if ((r = virtio_negotiate(vd, VIRTIO_FEATURE(VIRTIO_F_EVENT_IDX))) < 0 ||
+        (r = virtq_init(vd, &vcons.txq, VCONS_TXQ)) < 0)
+        goto fail;
+    if (vcons.txq.size < VCONS_NBUF) {
+        r = -E_INVAL;
+        goto fail;
+    }
+
+    for (i = 0; i < VCONS_NBUF; i++) {
+        if (!(pp = page_alloc(0))) {
+            r = -E_NO_MEM;
+            goto fail;
+        }
+        vcons.buf[i] = page2kva(pp);
+    }
+
+    virtio_ready(vd);
+    cons_set_sink(&vcons_sink);
+    return 1;
+
+fail:
+    memset(vcons.buf, 0, sizeof(vcons.buf));
+    virtio_fail(vd);
+    return r;
+}
@@ -0,0 +1,13 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_VIRTIO_CONS_H
+#define JOS_KERN_VIRTIO_CONS_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <kern/pci.h>
+
+int virtio_cons_attach(struct pci_func *f);
+
+#endif /* !JOS_KERN_VIRTIO_CONS_H */
@@ -0,0 +1,124 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Virtually contiguous kernel memory.
+ *
+ * vmalloc() reserves a range of the region [VMALLOCBASE, VMALLOCLIM) and
+ * backs each of its pages with a page of its own from page_alloc(), so a
+ * large buffer needs no physically contiguous memory and does not fail for
+ * fragmentation.  The region's page tables are static (entrypgdir.c):
+ * mapping a range just fills in consecutive PTEs, with no page table to
+ * allocate and no TLB entry to flush, since the PTEs were not present.
+ * Unmapping flushes the TLB once for the whole range when that is cheaper
+ * than a page at a time.
+ *
+ * An unmapped guard page follows every range, so that running off the end
+ * of one faults.  The memory has no physical address as a whole: it is not
+ * for DMA, and PADDR() rejects it.
+ */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/assert.h>
+
+#include <kern/pmap.h>
+#include <kern/vmalloc.h>
+
+#define VM_MAXAREAS     64
+#define VM_FLUSH_ALL    32      /* pages unmapped that are worth a CR3 load */
+
+/* The ranges in use, by address */
+static struct vm_area {
+    uintptr_t va;
+    size_t npages;              /* not counting the guard page */
+} vm_areas[VM_MAXAREAS];
+static int vm_nareas;
+
+/* The PTE for 'va' in the vmalloc region */
+static pte_t *vm_pte(uintptr_t va)
+{
+    extern pte_t vmalloc_pgtable[][NPTENTRIES];
+    size_t i = (va - VMALLOCBASE) >> PGSHIFT;
+
+    return &vmalloc_pgtable[i / NPTENTRIES][i % NPTENTRIES];
+}
+
+/* Unmap the 'n' pages at 'va' and drop their references. */
+static void vm_unmap(uintptr_t va, size_t n)
+{
+    pte_t *pte;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        pte = vm_pte(va + i * PGSIZE);
+        page_decref(pa2page(PTE_ADDR(*pte)));
+        *pte = 0;
+        if (n <= VM_FLUSH_ALL)
+            invlpg((void *) (va + i * PGSIZE));
+    }
+    if (n > VM_FLUSH_ALL)
+        lcr3(rcr3());
+}
+
+/* Map the 'n' unmapped pages at 'va' to newly allocated pages. */
+static int vm_map(uintptr_t va, size_t n, int alloc_flags)
+{
+    struct page_info *pp;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!(pp = page_alloc(alloc_flags & ALLOC_ZERO))) {
+            vm_unmap(va, i);
+            return -1;
+        }
+        pp->pp_ref++;
+        *vm_pte(va + i * PGSIZE) = page2pa(pp) | PTE_W | PTE_P;
+    }
+    return 0;
+}
+
+/* Allocate 'size' bytes of virtually contiguous kernel memory, zeroed if
+ * (alloc_flags & ALLOC_ZERO).  Returns NULL if the vmalloc region or
+ * physical memory runs out. */
+void *vmalloc(size_t size, int alloc_flags)
+{
+    size_t n = ROUNDUP(size, PGSIZE) / PGSIZE;
+    uintptr_t va = VMALLOCBASE;
+    int i, j;
+
+    if (n == 0 || n >= VMALLOCSIZE / PGSIZE || vm_nareas == VM_MAXAREAS)
+        return NULL;
+
+    /* The first gap with room for the range and its guard page */
+    for (i = 0; i < vm_nareas; i++) {
+        if (vm_areas[i].va - va >= (n + 1) * PGSIZE)
+            break;
+        va = vm_areas[i].va + (vm_areas[i].npages + 1) * PGSIZE;
+    }
+    if (VMALLOCLIM - va < (n + 1) * PGSIZE || vm_map(va, n, alloc_flags) < 0)
+        return NULL;
+
+    for (j = vm_nareas++; j > i; j--)
+        vm_areas[j] = vm_areas[j - 1];
+    vm_areas[i].va = va;
+    vm_areas[i].npages = n;
+    return (void *) va;
+}
+
+/* Free memory from vmalloc(). */
+void vfree(void *va)
+{
+    int i;
+
+    if (!va)
+        return;
+    for (i = 0; i < vm_nareas; i++)
+        if (vm_areas[i].va == (uintptr_t) va)
+            break;
+    if (i == vm_nareas)
+        panic("vfree: %08x is not from vmalloc", va);
+
+    vm_unmap(vm_areas[i].va, vm_areas[i].npages);
+    for (vm_nareas--; i < vm_nareas; i++)
+        vm_areas[i] = vm_areas[i + 1];
+}
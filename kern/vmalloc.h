@@ -0,0 +1,14 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_VMALLOC_H
+#define JOS_KERN_VMALLOC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+void *vmalloc(size_t size, int alloc_flags);
+void vfree(void *va);
+
+#endif /* !JOS_KERN_VMALLOC_H */
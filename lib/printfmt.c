@@ -28,6 +28,11 @@ static const char * const error_string[MAXERROR] =
     [E_NO_MEM]  = "out of memory",
     [E_NO_FREE_ENV] = "out of environments",
     [E_FAULT]   = "segmentation fault",
+    [E_IO]      = "I/O error",
+    [E_NOT_FOUND] = "not found",
+    [E_NO_DISK] = "out of disk space",
+    [E_BAD_PATH] = "bad path",
+    [E_FILE_EXISTS] = "file already exists",
 };
 
 /*
@@ -0,0 +1,108 @@
+/*
+ * Decoder for compressed binaries (inc/zbin.h), used by the kernel and by
+ * tools/mkzbin.c to check what it writes.
+ */
+
+#include <inc/zbin.h>
+#include <inc/error.h>
+
+/* Check that 'data' is a well-formed compressed binary and return its
+ * decompressed size. */
+int zbin_check(const void *data, size_t size)
+{
+    const struct zbin_hdr *z = data;
+    uint32_t n, i;
+
+    if (size < sizeof(*z) || z->z_magic != ZBIN_MAGIC ||
+        z->z_size > 0x7FFFFFFF)
+        return -E_INVAL;
+    n = ZBIN_NCHUNK(z->z_size);
+    if ((size - sizeof(*z)) / sizeof(uint32_t) < n + 1 ||
+        z->z_off[0] != sizeof(*z) + (n + 1) * sizeof(uint32_t) ||
+        z->z_off[n] > size)
+        return -E_INVAL;
+    for (i = 0; i < n; i++)
+        if (z->z_off[i + 1] < z->z_off[i] ||
+            z->z_off[i + 1] - z->z_off[i] > ZBIN_CHUNK)
+            return -E_INVAL;
+    return z->z_size;
+}
+
+/* Add the extension bytes of a literal count or match length to *n. */
+static int zbin_getlen(const uint8_t **src, const uint8_t *send, size_t *n)
+{
+    uint8_t b;
+
+    do {
+        if (*src == send)
+            return -E_INVAL;
+        b = *(*src)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+/* Decompress one chunk, 'slen' bytes at 'src', into at most 'dlen' bytes at
+ * 'dst'.  Returns the number of bytes written. */
+int zbin_decode(const uint8_t *src, size_t slen, uint8_t *dst, size_t dlen)
+{
+    const uint8_t *send = src + slen, *m;
+    uint8_t *d = dst, *dend = dst + dlen;
+    size_t n, off;
+    int token;
+
+    while (src < send) {
+        token = *src++;
+
+        n = token >> 4;
+        if (n == 15 && zbin_getlen(&src, send, &n) < 0)
+            return -E_INVAL;
+        if (n > (size_t) (send - src) || n > (size_t) (dend - d))
+            return -E_INVAL;
+        while (n--)
+            *d++ = *src++;
+        if (src == send)
+            break;
+
+        if (send - src < 2)
+            return -E_INVAL;
+        off = src[0] | src[1] << 8;
+        src += 2;
+        n = (token & 15) + ZBIN_MINMATCH;
+        if ((token & 15) == 15 && zbin_getlen(&src, send, &n) < 0)
+            return -E_INVAL;
+        if (off == 0 || off > (size_t) (d - dst) ||
+            n > (size_t) (dend - d))
+            return -E_INVAL;
+        /* The copy may overlap what it produces: byte at a time. */
+        for (m = d - off; n--; )
+            *d++ = *m++;
+    }
+    return d - dst;
+}
+
+/* Decompress chunk 'i' of a checked binary into 'dst', which must have room
+ * for ZBIN_CHUNK bytes.  Returns the chunk's size. */
+int zbin_chunk(const struct zbin_hdr *z, uint32_t i, void *dst)
+{
+    const uint8_t *src;
+    uint8_t *d = dst;
+    uint32_t len, slen;
+
+    if (i >= ZBIN_NCHUNK(z->z_size))
+        return -E_INVAL;
+    len = z->z_size - i * ZBIN_CHUNK;
+    if (len > ZBIN_CHUNK)
+        len = ZBIN_CHUNK;
+    src = (const uint8_t *) z + z->z_off[i];
+    slen = z->z_off[i + 1] - z->z_off[i];
+
+    if (slen == len) {
+        while (slen--)
+            *d++ = *src++;
+        return len;
+    }
+    if (zbin_decode(src, slen, d, len) != (int) len)
+        return -E_INVAL;
+    return len;
+}
@@ -0,0 +1,62 @@
+/*
+ * gcda: split the coverage counters that a GCOV=1 kernel writes to the
+ * debug console (see kern/gcov.c) into .gcda files.
+ *
+ *    gcda < obj/gcov.out
+ *
+ * Each file goes where the compiler said it should, beside its object; a
+ * later dump of the same file replaces an earlier one.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+static void panic(const char *fmt, ...) __attribute__((noreturn));
+
+static void panic(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "gcda: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    char line[PATH_MAX + 32], *sp, *data;
+    unsigned long size;
+    int nfiles = 0;
+    FILE *f;
+
+    if (argc != 1) {
+        fprintf(stderr, "Usage: gcda < dump\n");
+        return 2;
+    }
+
+    while (fgets(line, sizeof(line), stdin)) {
+        /* "gcov <file> <size>\n" */
+        if (strncmp(line, "gcov ", 5) != 0 || !(sp = strrchr(line, ' ')) ||
+            sp < line + 5 || sscanf(sp, "%lu", &size) != 1)
+            panic("bad record header: %s", line);
+        *sp = 0;
+
+        if (!(data = malloc(size + 1)) || fread(data, 1, size, stdin) != size)
+            panic("%s: short record", line + 5);
+        if (!(f = fopen(line + 5, "wb")))
+            panic("%s: %s", line + 5, strerror(errno));
+        if (fwrite(data, 1, size, f) != size || fclose(f) != 0)
+            panic("%s: write failed", line + 5);
+        free(data);
+        nfiles++;
+    }
+    printf("%d .gcda files written\n", nfiles);
+    return 0;
+}
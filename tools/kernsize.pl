@@ -0,0 +1,107 @@
+#!/usr/bin/perl
+#
+# Usage: kernsize.pl [-u] <budget> <kernel> <objdump> <nm>
+#
+# Reports the size of each section of <kernel> that takes up memory, and
+# the largest symbols, and checks the sizes against the limits in <budget>.
+# The budget has one "<section> <limit in bytes>" pair per line, and '#'
+# starts a comment; the section 'load' stands for all the bytes the boot
+# loader has to read.  A limit of '-' has not been measured yet, and is not
+# checked.  Exits with status 1 if any section has outgrown its limit.
+#
+# With -u, rewrites the limits in <budget> (measured or not) to fit the
+# kernel as it is, with 5% to spare, rounded up to a kilobyte.
+#
+
+use strict;
+
+my $NTOP = 15;
+
+my $update = 0;
+if (@ARGV && $ARGV[0] eq "-u") {
+    $update = 1;
+    shift @ARGV;
+}
+die "usage: kernsize.pl [-u] budget kernel objdump nm\n" if @ARGV != 4;
+my ($budget, $kernel, $objdump, $nm) = @ARGV;
+
+# Sections, from the section headers: a line with the name and the size,
+# then a line of flags.
+my (@secs, %size, $name, $size);
+open(OD, "$objdump -h $kernel |") || die "$objdump: $!";
+while (<OD>) {
+    if (/^\s*\d+\s+(\S+)\s+([0-9a-fA-F]+)\s/) {
+        ($name, $size) = ($1, hex($2));
+    } elsif (defined($name)) {
+        if (/\bALLOC\b/) {
+            push @secs, $name;
+            $size{$name} = $size;
+            $size{load} += $size if /\bLOAD\b/;
+        }
+        undef $name;
+    }
+}
+close(OD) || die "$objdump -h $kernel failed\n";
+push @secs, "load";
+
+# The limits, and the budget's lines for -u
+my (%limit, @lines);
+open(BUDGET, $budget) || die "open $budget: $!";
+while (<BUDGET>) {
+    push @lines, $_;
+    s/#.*//;
+    next if /^\s*$/;
+    die "$budget:$.: expected '<section> <limit>'\n"
+        unless /^\s*(\S+)\s+(\d+|-)\s*$/;
+    $limit{$1} = $2;
+}
+close(BUDGET);
+
+if ($update) {
+    open(BUDGET, ">$budget") || die "open >$budget: $!";
+    foreach (@lines) {
+        if (/^(\s*(\S+)\s+)(\d+|-)\s*$/ && defined($size{$2})) {
+            my $lim = int(($size{$2} * 21 / 20 + 1023) / 1024) * 1024;
+            $_ = "$1$lim\n";
+        }
+        print BUDGET;
+    }
+    close(BUDGET);
+    print "$budget updated\n";
+    exit 0;
+}
+
+my ($fail, $unmeasured) = (0, 0);
+printf "%-16s %10s %10s\n", "section", "size", "limit";
+foreach $name (@secs, grep { !defined($size{$_}) } sort keys %limit) {
+    my $sz = defined($size{$name}) ? $size{$name} : "-";
+    my $lim = defined($limit{$name}) ? $limit{$name} : "-";
+    my $note = "";
+    $unmeasured++ if $lim eq "-" && defined($limit{$name});
+    if ($sz ne "-" && $lim ne "-" && $sz > $lim) {
+        $note = sprintf("  OVER by %d", $sz - $lim);
+        $fail = 1;
+    }
+    printf "%-16s %10s %10s%s\n", $name, $sz, $lim, $note;
+}
+
+# The largest symbols; the type says where each lives (t: .text,
+# r: .rodata, d: .data, b: .bss; upper case if global).
+print "\nlargest symbols:\n";
+open(NM, "$nm -S --size-sort -r $kernel |") || die "$nm: $!";
+my $n = 0;
+while (<NM>) {
+    next unless /^[0-9a-fA-F]+\s+([0-9a-fA-F]+)\s+(\S)\s+(\S+)/;
+    printf "%10d %s %s\n", hex($1), $2, $3;
+    last if ++$n == $NTOP;
+}
+close(NM);
+
+if ($unmeasured) {
+    print STDERR "$unmeasured limits in $budget are not measured yet: run ",
+        "'make size-budget' with the lab toolchain\n";
+}
+if ($fail) {
+    print STDERR "$kernel is over its size budget ($budget)\n";
+    exit 1;
+}
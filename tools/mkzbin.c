@@ -0,0 +1,188 @@
+/*
+ * mkzbin: compress a binary for embedding in the kernel (inc/zbin.h).
+ *
+ *    mkzbin input output
+ *
+ * Each chunk is compressed greedily with a hash table of the last position
+ * of every 4-byte string, which is quick and good enough for program text;
+ * the kernel only ever pays for decompression.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/* Prevent inc/types.h, included from inc/zbin.h, from attempting to
+ * redefine types defined in the host's headers. */
+#define JOS_INC_TYPES_H
+typedef int bool;
+typedef uint32_t physaddr_t;
+#define ROUNDUP(a, n)   (((a) + (n) - 1) / (n) * (n))
+
+#include <inc/zbin.h>
+
+/* The kernel's decoder, to check every chunk we write. */
+#include <lib/zbin.c>
+
+#define HASH_BITS       12
+
+static void panic(const char *fmt, ...) __attribute__((noreturn));
+
+static void panic(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "mkzbin: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+static uint32_t hash4(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* Append the extension bytes for a count of 'n' past 15. */
+static int put_len(uint8_t **o, uint8_t *oend, size_t n)
+{
+    for (; n >= 255; n -= 255) {
+        if (*o == oend)
+            return -1;
+        *(*o)++ = 255;
+    }
+    if (*o == oend)
+        return -1;
+    *(*o)++ = n;
+    return 0;
+}
+
+/* Append a sequence: 'nlit' literals, then a copy of 'mlen' bytes from
+ * 'off' back, unless 'mlen' is 0. */
+static int put_seq(uint8_t **o, uint8_t *oend, const uint8_t *lit,
+                   size_t nlit, size_t off, size_t mlen)
+{
+    size_t ml = mlen ? mlen - ZBIN_MINMATCH : 0;
+
+    if (*o == oend)
+        return -1;
+    *(*o)++ = (nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15);
+    if (nlit >= 15 && put_len(o, oend, nlit - 15) < 0)
+        return -1;
+    if ((size_t) (oend - *o) < nlit)
+        return -1;
+    memcpy(*o, lit, nlit);
+    *o += nlit;
+    if (!mlen)
+        return 0;
+
+    if (oend - *o < 2)
+        return -1;
+    *(*o)++ = off & 0xFF;
+    *(*o)++ = off >> 8;
+    if (ml >= 15 && put_len(o, oend, ml - 15) < 0)
+        return -1;
+    return 0;
+}
+
+/* Compress 'len' bytes into at most 'cap' bytes at 'out'.  Returns the
+ * compressed size, or -1 if it does not fit. */
+static long compress(const uint8_t *in, size_t len, uint8_t *out, size_t cap)
+{
+    static long table[1 << HASH_BITS];
+    uint8_t *o = out, *oend = out + cap;
+    size_t ip = 0, anchor = 0, mlen;
+    uint32_t h;
+    long cand;
+
+    memset(table, 0xFF, sizeof(table));
+    while (ip + ZBIN_MINMATCH <= len) {
+        h = hash4(in + ip);
+        cand = table[h];
+        table[h] = ip;
+        if (cand < 0 || memcmp(in + cand, in + ip, ZBIN_MINMATCH) != 0) {
+            ip++;
+            continue;
+        }
+        for (mlen = ZBIN_MINMATCH;
+             ip + mlen < len && in[cand + mlen] == in[ip + mlen]; mlen++)
+            /* do nothing */;
+        if (put_seq(&o, oend, in + anchor, ip - anchor, ip - cand, mlen) < 0)
+            return -1;
+        ip += mlen;
+        anchor = ip;
+    }
+    if (put_seq(&o, oend, in + anchor, len - anchor, 0, 0) < 0)
+        return -1;
+    return o - out;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t *in, *out, chunk[ZBIN_CHUNK];
+    struct zbin_hdr *z;
+    uint32_t nchunk, i, len, pos;
+    long size, n;
+    FILE *f;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: mkzbin input output\n");
+        return 2;
+    }
+
+    if (!(f = fopen(argv[1], "rb")))
+        panic("%s: %s", argv[1], strerror(errno));
+    if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0)
+        panic("%s: %s", argv[1], strerror(errno));
+    if (size > 0x7FFFFFFF)
+        panic("%s: too big", argv[1]);
+    rewind(f);
+    if (!(in = malloc(size + 1)) || fread(in, 1, size, f) != (size_t) size)
+        panic("%s: short read", argv[1]);
+    fclose(f);
+
+    /* Compressed chunks are never bigger than the input ones. */
+    nchunk = ZBIN_NCHUNK(size);
+    pos = sizeof(*z) + (nchunk + 1) * sizeof(uint32_t);
+    if (!(out = malloc(pos + size)))
+        panic("out of memory");
+    z = (struct zbin_hdr *) out;
+    z->z_magic = ZBIN_MAGIC;
+    z->z_size = size;
+
+    for (i = 0; i < nchunk; i++) {
+        z->z_off[i] = pos;
+        len = size - i * ZBIN_CHUNK;
+        if (len > ZBIN_CHUNK)
+            len = ZBIN_CHUNK;
+        n = compress(in + i * ZBIN_CHUNK, len, out + pos, len - 1);
+        if (n < 0) {
+            memcpy(out + pos, in + i * ZBIN_CHUNK, len);
+            n = len;
+        }
+        pos += n;
+    }
+    z->z_off[nchunk] = pos;
+
+    if (zbin_check(out, pos) != size)
+        panic("%s: bad header", argv[2]);
+    for (i = 0; i < nchunk; i++) {
+        n = zbin_chunk(z, i, chunk);
+        if (n < 0 || memcmp(chunk, in + i * ZBIN_CHUNK, n) != 0)
+            panic("%s: chunk %u does not decompress", argv[2], i);
+    }
+
+    if (!(f = fopen(argv[2], "wb")))
+        panic("%s: %s", argv[2], strerror(errno));
+    if (fwrite(out, 1, pos, f) != pos || fclose(f) != 0)
+        panic("%s: write failed", argv[2]);
+    return 0;
+}